@@ -6,6 +6,23 @@ User::User(int argc, char** argv){
     m_uid = "";
     m_pass = "";
     m_gid = "";
+    m_keepalive = false;
+    m_framed = false;
+    m_meta = false;
+    m_chunked = false;
+    m_upload.id = "";
+    m_inbox_next = 0;
+    socketTCP = NULL;
+    m_tcp_res = NULL;
+    memset(&m_groups, 0, sizeof(GROUPCACHE));
+    memset(&m_my_groups, 0, sizeof(GROUPCACHE));
+
+    /* Commands are read straight from the descriptor, so that a 
+    watch can tell when the next one is typed (see watch) */
+    setvbuf(stdin, NULL, _IONBF, 0);
+
+    /* A server gone mid-request must only fail that write */
+    signal(SIGPIPE, SIG_IGN);
 
     parse_arguments(argc, argv);
 
@@ -17,12 +34,21 @@ User::User(int argc, char** argv){
 //:::::::::::::::: INITIALIZATION/TERMINATION ::::::::::::::::://
 /**
  * Parses the arguments used when invoking the user application.
- * Usage: ./user [-n DSIP] [-p DSport]
+ * Usage: ./user [-n DSIP] [-p DSport] [-k] [-2] [-m] [-u]
  * . DSIP is the IP address of the machine where DS runs. If it's
  * ommited then DS runs on the same machine.
  * . DSport is the well-known port where DS accepts requests. If 
  * it's ommited then it assumes the value 58000+GN where GN is 
  * the group number (12).
+ * . if the -k option is set, the user application keeps a single
+ * persistent TCP session with the DS, used by every ulist, post
+ * and retrieve, instead of connecting once per command.
+ * . if the -2 option is set, ulist, post and retrieve requests are
+ * sent with the binary framing (v2) instead of as text.
+ * . if the -m option is set, retrieve only describes the attach-
+ * ments (Fname Fsize), which are fetched with attachment.
+ * . if the -u option is set, post sends a file in chunks, through
+ * an upload which is resumed if the post breaks.
  * 
  * @param argc number of arguments
  * @param argv vector of arguments
@@ -32,7 +58,7 @@ void User::parse_arguments(int argc, char** argv) {
     int max_argc = 1;
 
     char c;
-    while((c = getopt(argc, argv, "n:p:")) != -1) {
+    while((c = getopt(argc, argv, "n:p:k2mu")) != -1) {
         switch(c) {
             case 'n':
                 m_dsip = optarg;
@@ -42,8 +68,24 @@ void User::parse_arguments(int argc, char** argv) {
                 m_dsport = optarg;
                 max_argc += 2;
                 break;
+            case 'k':
+                m_keepalive = true;
+                max_argc += 1;
+                break;
+            case '2':
+                m_framed = true;
+                max_argc += 1;
+                break;
+            case 'm':
+                m_meta = true;
+                max_argc += 1;
+                break;
+            case 'u':
+                m_chunked = true;
+                max_argc += 1;
+                break;
             default:
-                fprintf(stderr, "Usage: %s [-n DSIP] [-p DSport]\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-n DSIP] [-p DSport] [-k] [-2] [-m] [-u]\n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
@@ -57,7 +99,7 @@ void User::parse_arguments(int argc, char** argv) {
     }
         
     if(max_argc < argc) {
-        fprintf(stderr, "Usage: %s [-n DSIP] [-p DSport]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-n DSIP] [-p DSport] [-k] [-2] [-m] [-u]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 }
@@ -91,82 +133,131 @@ void User::handle_keyboard_input() {
         string arg1_str = string(arg1);
         string arg2_str = string(arg2);
 
-        if(!strcmp(command, USER_REG)){
-            if (!check_nparam(numTokens, 3, USER_REG)) continue;
-            reg(arg1_str, arg2_str);
-        }
+        switch(pack_command(command)){
+            case pack_command(USER_REG):
+                if (!check_nparam(numTokens, 3, USER_REG)) break;
+                reg(arg1_str, arg2_str);
+                break;
 
-        if((!strcmp(command, USER_UNREGISTER_ALT)) || (!strcmp(command, USER_UNREGISTER))){
-            if (!check_nparam(numTokens, 3, USER_UNREGISTER)) continue;
-            unregister(arg1_str, arg2_str);
-        }
+            case pack_command(USER_UNREGISTER):
+            case pack_command(USER_UNREGISTER_ALT):
+                if (!check_nparam(numTokens, 3, USER_UNREGISTER)) break;
+                unregister(arg1_str, arg2_str);
+                break;
 
-        if(!strcmp(command, USER_LOGIN)){
-            if (!check_nparam(numTokens, 3, USER_LOGIN)) continue;
-            login(arg1_str, arg2_str);
-        }
+            case pack_command(USER_LOGIN):
+                if (!check_nparam(numTokens, 3, USER_LOGIN)) break;
+                login(arg1_str, arg2_str);
+                break;
 
-        if(!strcmp(command, USER_LOGOUT)){
-            if (!check_nparam(numTokens, 1, USER_LOGOUT)) continue;
-            logout();
-        }
+            case pack_command(USER_LOGOUT):
+                if (!check_nparam(numTokens, 1, USER_LOGOUT)) break;
+                logout();
+                break;
 
-        if(!strcmp(command, USER_SHOWUID) || !strcmp(command, USER_SHOWUID_ALT)){
-            if (!check_nparam(numTokens, 1, USER_SHOWUID)) continue;
-            showuid();
-        }
+            case pack_command(USER_SHOWUID):
+            case pack_command(USER_SHOWUID_ALT):
+                if (!check_nparam(numTokens, 1, USER_SHOWUID)) break;
+                showuid();
+                break;
 
-        if(!strcmp(command, USER_EXIT)){
-            if (!check_nparam(numTokens, 1, USER_EXIT)) continue;
-            usr_exit();
-        }
-        
-        if(!strcmp(command, USER_SUBSCRIBE) || !strcmp(command, USER_SUBSCRIBE_ALT)){
-            if (!check_nparam(numTokens, 3, USER_SUBSCRIBE)) continue;
-            subscribe(arg1_str, arg2_str);
-        }
+            case pack_command(USER_EXIT):
+                if (!check_nparam(numTokens, 1, USER_EXIT)) break;
+                usr_exit();
+                break;
 
-        if(!strcmp(command, USER_GROUPS) || !strcmp(command, USER_GROUPS_ALT)){
-            if (!check_nparam(numTokens, 1, USER_GROUPS)) continue;
-            groups();
-        }
+            case pack_command(USER_SUBSCRIBE):
+            case pack_command(USER_SUBSCRIBE_ALT):
+                if (!check_nparam(numTokens, 3, USER_SUBSCRIBE)) break;
+                subscribe(arg1_str, arg2_str);
+                break;
 
-        if(!strcmp(command, USER_UNSUBSCRIBE) || !strcmp(command, USER_UNSUBSCRIBE_ALT)){
-            if (!check_nparam(numTokens, 2, USER_UNSUBSCRIBE)) continue;
-            unsubscribe(arg1_str);
-        }
+            case pack_command(USER_GROUPS):
+            case pack_command(USER_GROUPS_ALT):
+                if (!check_nparam(numTokens, 1, USER_GROUPS)) break;
+                groups();
+                break;
 
-        if(!strcmp(command, USER_MY_GROUPS) || !strcmp(command, USER_MY_GROUPS_ALT)){
-            if (!check_nparam(numTokens, 1, USER_MY_GROUPS)) continue;
-            my_groups();
-        }
-                
-        if(!strcmp(command, USER_SELECT) || !strcmp(command, USER_SELECT_ALT)){
-            if (!check_nparam(numTokens, 2, USER_SELECT)) continue;
-            usr_select(arg1_str);
-        }
+            case pack_command(USER_UNSUBSCRIBE):
+            case pack_command(USER_UNSUBSCRIBE_ALT):
+                if (!check_nparam(numTokens, 2, USER_UNSUBSCRIBE)) break;
+                unsubscribe(arg1_str);
+                break;
 
-        if(!strcmp(command, USER_SHOWGID) || !strcmp(command, USER_SHOWGID_ALT)){
-            if (!check_nparam(numTokens, 1, USER_SHOWGID)) continue;
-            showgid();
-        }
+            case pack_command(USER_MY_GROUPS):
+            case pack_command(USER_MY_GROUPS_ALT):
+                if (!check_nparam(numTokens, 1, USER_MY_GROUPS)) break;
+                my_groups();
+                break;
 
-        if (!strcmp(command, USER_ULIST) || !strcmp(command, USER_ULIST_ALT)){
-            if (!check_nparam(numTokens, 1, USER_ULIST)) continue;
-            ulist();
-        }
+            case pack_command(USER_SELECT):
+            case pack_command(USER_SELECT_ALT):
+                if (!check_nparam(numTokens, 2, USER_SELECT)) break;
+                usr_select(arg1_str);
+                break;
 
-        if(!strcmp(command, USER_POST)){
-            char text[MAX_INPUT_SIZE] = {'\0'};
-            char fname[MAX_INPUT_SIZE] = {'\0'};
-            numTokens = sscanf(line, "%s \"%[^\"]\" %s", command, text, fname);
+            case pack_command(USER_SHOWGID):
+            case pack_command(USER_SHOWGID_ALT):
+                if (!check_nparam(numTokens, 1, USER_SHOWGID)) break;
+                showgid();
+                break;
 
-            post(string(text), string(fname), numTokens);
-        }
-        
-        if(!strcmp(command, USER_RETRIEVE) || !strcmp(command, USER_RETRIEVE_ALT)){
-            if (!check_nparam(numTokens, 2, USER_RETRIEVE)) return;
-            retrieve(arg1_str);
+            case pack_command(USER_ULIST):
+            case pack_command(USER_ULIST_ALT):
+                if (!check_nparam(numTokens, 1, USER_ULIST)) break;
+                ulist();
+                break;
+
+            case pack_command(USER_POST):{
+                char text[MAX_INPUT_SIZE] = {'\0'};
+                char fname[MAX_INPUT_SIZE] = {'\0'};
+                numTokens = sscanf(line, "%s \"%[^\"]\" %s", command, text, fname);
+
+                post(string(text), string(fname), numTokens);
+                break;
+            }
+
+            case pack_command(USER_RETRIEVE):
+            case pack_command(USER_RETRIEVE_ALT):
+                if (!check_nparam(numTokens, 2, USER_RETRIEVE)) break;
+                retrieve(arg1_str);
+                break;
+
+            case pack_command(USER_WATCH):
+            case pack_command(USER_WATCH_ALT):
+                if (!check_nparam(numTokens, 1, USER_WATCH)) break;
+                watch();
+                break;
+
+            case pack_command(USER_INBOX):
+            case pack_command(USER_INBOX_ALT):
+                if (!check_nparam(numTokens, 1, USER_INBOX)) break;
+                inbox();
+                break;
+
+            case pack_command(USER_FEED):
+            case pack_command(USER_FEED_ALT):
+                if (!check_nparam(numTokens, 2, USER_FEED)) break;
+                feed(arg1_str);
+                break;
+
+            case pack_command(USER_HISTORY):
+            case pack_command(USER_HISTORY_ALT):
+                if (!check_nparam(numTokens, 2, USER_HISTORY)) break;
+                history(arg1_str);
+                break;
+
+            case pack_command(USER_TAIL):
+            case pack_command(USER_TAIL_ALT):
+                if (!check_nparam(numTokens, 2, USER_TAIL)) break;
+                tail(arg1_str);
+                break;
+
+            case pack_command(USER_ATTACHMENT):
+            case pack_command(USER_ATTACHMENT_ALT):
+                if (!check_nparam(numTokens, 2, USER_ATTACHMENT)) break;
+                attachment(arg1_str);
+                break;
         }
     } 
 }
@@ -177,6 +268,10 @@ void User::handle_keyboard_input() {
  */
 void User::terminate() {
     disconnect(socketUDP);
+    disconnectTCP();
+    if (m_tcp_res != NULL){
+        freeaddrinfo(m_tcp_res);
+    }
     exit(EXIT_SUCCESS);
 }
 
@@ -216,48 +311,329 @@ void User::connectUDP(string ip, string port){
     strcpy(socketUDP->owner, USER);
     socketUDP->fd = fd;
     socketUDP->res = res;
+    socketUDP->rpos = 0;
+    socketUDP->rlen = 0;
+    socketUDP->deadline = 0;
 }
 
 /**
- * Creates a TCP socket to communicate with the server specified
- * by ip and port.
+ * Resolves the TCP address of the server specified by ip and 
+ * port. The result is cached, so it is only looked up once, no 
+ * matter how many TCP connections are made afterwards.
  * 
  * @param ip the ip address of the machine where the directory 
  * server (DS) runs
  * @param port the well-known port (TCP and UDP) where the DS 
  * server accepts requests
  */
-void User::connectTCP(string ip, string port){
-    int fd;
-    struct addrinfo * res;
+void User::resolveTCP(string ip, string port){
     int errcode;
 	struct addrinfo hints;
 
-    fd = socket(AF_INET,SOCK_STREAM,0);
-	if(fd == FAIL){
-        fprintf(stderr, "Unable to create socket.\n");
-        exit(EXIT_FAILURE);
+    if (m_tcp_res != NULL){
+        return;
     }
 
 	memset(&hints,0,sizeof hints);
 	hints.ai_family = AF_INET;
 	hints.ai_socktype = SOCK_STREAM;
 
-	errcode = getaddrinfo(ip.c_str(), port.c_str(), &hints, &res);
+	errcode = getaddrinfo(ip.c_str(), port.c_str(), &hints, &m_tcp_res);
 	if(errcode != SUCCESS){
         fprintf(stderr, "Unable to link to server.\n");
         exit(EXIT_FAILURE);
     }
+}
 
-    if(connect(fd,res->ai_addr, res->ai_addrlen) == FAIL){
-        fprintf(stderr, "Unable to connect to server");
-        exit(EXIT_FAILURE);
+/**
+ * Creates a TCP socket to communicate with the server specified
+ * by ip and port.
+ * 
+ * @param ip the ip address of the machine where the directory 
+ * server (DS) runs
+ * @param port the well-known port (TCP and UDP) where the DS 
+ * server accepts requests
+ * @return int SUCCESS or FAIL
+ */
+int User::connectTCP(string ip, string port){
+    int fd;
+
+    resolveTCP(ip, port);
+
+    fd = socket(AF_INET,SOCK_STREAM,0);
+	if(fd == FAIL){
+        fprintf(stderr, "Unable to create socket.\n");
+        return FAIL;
+    }
+
+    /* The command fails, but the user may go on with the others
+    (e.g. the UDP ones) */
+    if(connect(fd,m_tcp_res->ai_addr, m_tcp_res->ai_addrlen) == FAIL){
+        fprintf(stderr, "Unable to connect to server, please try again!\n");
+        close(fd);
+        return FAIL;
     }
 
     socketTCP = (SOCKET *) malloc(sizeof(SOCKET));
     strcpy(socketTCP->owner, USER);
     socketTCP->fd = fd;
-    socketTCP->res = res;
+    socketTCP->res = m_tcp_res;
+    socketTCP->rpos = 0;
+    socketTCP->rlen = 0;
+    socketTCP->deadline = 0;
+    set_deadlines(socketTCP, SESSION_TIMEOUT);
+    return SUCCESS;
+}
+
+/**
+ * Checks if the idle TCP session is still usable. No answer is 
+ * pending while it's idle, so if it's readable (or has buffered
+ * bytes) the DS has either closed it (e.g. its deadline expired) 
+ * or broken the protocol.
+ * 
+ * @return true if the session can carry the next request
+ * @return false if it must be replaced
+ */
+bool User::session_alive(){
+    if (socketTCP->rpos < socketTCP->rlen){
+        return false;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = socketTCP->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, 0) == 0){
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Opens the TCP session used by the next command. Without -k, a
+ * new connection is made every time. With -k, the first command
+ * opens a persistent session (SES), which is then reused by the 
+ * following ones until it is closed.
+ * 
+ * @return int SUCCESS or FAIL, if the DS couldn't be reached
+ */
+int User::open_session(){
+    if (socketTCP != NULL){
+        if (session_alive()){
+            return SUCCESS;
+        }
+        disconnectTCP();
+    }
+    if (connectTCP(m_dsip, m_dsport) == FAIL){
+        return FAIL;
+    }
+
+    /* Framed requests ask for the session to be kept themselves */
+    if (!m_keepalive || m_framed){
+        return SUCCESS;
+    }
+
+    /**
+     * Format: SES
+     * Answer: RSE OK
+     */
+    string buffer = string(USER_SESSION_REQUEST) + "\n";
+    char header[MAX_STRING] = {'\0'};
+    char status[MAX_STRING] = {'\0'};
+    if (sendTCP(socketTCP, buffer, buffer.size()) != FAIL){
+        word_receiveTCP(socketTCP, header, MAX_HEAD_TCP);
+        word_receiveTCP(socketTCP, status, MAX_STRING - 1);
+        if (!strcmp(header, USER_SESSION_ANSWER) && !strcmp(status, OK)){
+            return SUCCESS;
+        }
+        /* The DS is busy right now: the command gets a connection 
+        of its own, and the session is tried again the next time */
+        if (!strcmp(header, BUSY)){
+            disconnectTCP();
+            return connectTCP(m_dsip, m_dsport);
+        }
+    }
+
+    /* The DS doesn't keep sessions open: connect once per command */
+    fprintf(stderr, "Persistent sessions unavailable. Connecting once per command.\n");
+    m_keepalive = false;
+    disconnectTCP();
+    return connectTCP(m_dsip, m_dsport);
+}
+
+/**
+ * Ends the TCP session used by a command whose answer was comple-
+ * tely received. The connection is closed, unless it's a persis-
+ * tent session.
+ */
+void User::close_session(){
+    if (!m_keepalive){
+        disconnectTCP();
+    }
+}
+
+/**
+ * Closes the TCP connection to the DS (if there's one).
+ */
+void User::disconnectTCP(){
+    if (socketTCP != NULL){
+        disconnect(socketTCP);
+        socketTCP = NULL;
+    }
+}
+
+/**
+ * Sends a UDP request, written according to its schema.
+ * Format: REQ[ field]*
+ * 
+ * @param request the request code (e.g. REG)
+ * @param fields the fields which follow the request code
+ * @return int SUCCESS or FAIL
+ */
+int User::send_requestUDP(const char * request, const char * const * fields){
+    char buffer[MAX_REQUEST_UDP] = {'\0'};
+    if (serialize_request(find_schema(request), fields, buffer) == FAIL){
+        return FAIL;
+    }
+    return sendUDP(socketUDP, string(buffer));
+}
+
+/**
+ * Gets the answer to a UDP request. An answer of BSY means the DS
+ * is over budget for this client: it's reported, and the request
+ * may be tried again later.
+ * 
+ * @param answer gets the answer
+ * @param size the size of the answer buffer
+ * @return int the number of bytes received or FAIL
+ */
+int User::receive_answerUDP(char * answer, int size){
+    int n = receiveUDP(socketUDP, answer, size);
+    if ((n != FAIL) && busy(answer)){
+        return FAIL;
+    }
+    return n;
+}
+
+/**
+ * Tells if an answer is BSY, which the DS sends instead of serving
+ * a request when it is over budget (or has too many sessions). It
+ * is reported, and the request may be tried again later.
+ * 
+ * @param answer the answer (or its header)
+ * @return true if the DS is busy
+ * @return false otherwise
+ */
+bool User::busy(const char * answer){
+    if (strncmp(answer, BUSY, strlen(BUSY)) || ((answer[strlen(BUSY)] != '\n') && (answer[strlen(BUSY)] != '\0'))){
+        return false;
+    }
+    fprintf(stderr, "The server is busy, please try again later.\n");
+    return true;
+}
+
+/**
+ * Sends a framed (v2) request: the header, followed by the fixed-
+ * width fields of the payload. With -k, the request asks the DS to
+ * keep the session open.
+ * 
+ * @param opcode the request (FRAME_ULIST, FRAME_POST, ...)
+ * @param payload the part of the payload sent right away
+ * @param extra the size of the payload sent afterwards (e.g. the
+ * data of a file)
+ * @param flags the flags of the request (e.g. FRAME_META)
+ * @return int the number of bytes sent or FAIL
+ */
+int User::send_frame(int opcode, string payload, long extra, int flags){
+    flags |= m_keepalive ? FRAME_KEEP : 0;
+    string buffer = pack_frame(opcode, flags, payload.size() + extra) + payload;
+    return sendbytesTCP(socketTCP, buffer.data(), buffer.size());
+}
+
+/**
+ * Gets the header and status of a TCP answer and displays the 
+ * result.
+ * Format: header status
+ * 
+ * @param answer the expected header of the answer
+ * @param command the command which the server replied to
+ * @param last_caracter if not NULL, gets the character after the
+ * status (' ' if the answer goes on, '\n' if it's over)
+ * @param status_out if not NULL, gets the status
+ * @param quiet whether the result isn't displayed
+ * @return 0 (false), 1 (true) or FAIL (-1), if the connection was
+ * lost (and closed)
+ */
+int User::receive_statusTCP(string answer, string command, char * last_caracter, string * status_out, bool quiet){
+    char header[MAX_STRING] = {'\0'};
+    char status[MAX_STRING] = {'\0'};
+    char delimiter = '\0';
+
+    if (word_receiveTCP(socketTCP, header, MAX_HEAD_TCP, &delimiter) == 0){
+        fprintf(stderr, "Connection to the server lost, please try again!\n");
+        disconnectTCP();
+        return FAIL;
+    }
+    if (busy(header)){
+        disconnectTCP();
+        return FAIL;
+    }
+    if (!strcmp(header, ERR)){
+        handle_error(SERVER, PROTOCOL);
+    }
+    if ((answer != header) || (delimiter != ' ')){
+        handle_error(SERVER, PROTOCOL);
+    }
+
+    word_receiveTCP(socketTCP, status, MAX_STRING - 1, &delimiter);
+    if (last_caracter != NULL){
+        last_caracter[0] = delimiter;
+    }
+    if (status_out != NULL){
+        *status_out = string(status);
+    }
+    if (quiet){
+        return !strcmp(status, OK);
+    }
+    return (int) process_status(status, "", command);
+}
+
+/**
+ * Gets a TCP answer which carries a number, without displaying it
+ * (e.g. the bytes of an upload received by the DS).
+ * Format: header OK number
+ * 
+ * @param answer the expected header of the answer
+ * @return long the number, or FAIL if the DS refused the request
+ * or the connection was lost (and closed)
+ */
+long User::receive_countTCP(string answer){
+    char header[MAX_STRING] = {'\0'};
+    char status[MAX_STRING] = {'\0'};
+    char number[MAX_STRING] = {'\0'};
+
+    if (word_receiveTCP(socketTCP, header, MAX_HEAD_TCP) == 0){
+        fprintf(stderr, "Connection to the server lost, please try again!\n");
+        disconnectTCP();
+        return FAIL;
+    }
+    if (busy(header)){
+        disconnectTCP();
+        return FAIL;
+    }
+    if (!strcmp(header, ERR) || strcmp(header, answer.c_str())){
+        handle_error(SERVER, PROTOCOL);
+    }
+    word_receiveTCP(socketTCP, status, MAX_STRING - 1);
+    if (strcmp(status, OK)){
+        return FAIL;
+    }
+    word_receiveTCP(socketTCP, number, MAX_FSIZE + 1);
+    if (!parse_fsize(number)){
+        handle_error(SERVER, PROTOCOL);
+    }
+    return atol(number);
 }
 
 /**
@@ -273,22 +649,23 @@ void User::connectTCP(string ip, string port){
  * which means there will be no more actions on the server's ans-
  * wer
  */
-bool User::process_status(string status, string extra, string command){
+bool User::process_status(string_view status, string_view extra, string_view command){
     if (status == OK){
-        fprintf(stdout, "%s successful.\n", command.c_str());
+        fprintf(stdout, "%.*s successful.\n", (int) command.size(), command.data());
         return true;
     }
     else if (status == NOK){
-        fprintf(stdout, "%s unsuccessful.\n", command.c_str());
+        fprintf(stdout, "%.*s unsuccessful.\n", (int) command.size(), command.data());
         return false;
     }
     else if (status == DUP){
-        fprintf(stdout, "%s unsuccessful. Duplicate user.\n", command.c_str());
+        fprintf(stdout, "%.*s unsuccessful. Duplicate user.\n", (int) command.size(), command.data());
         return false;
     }
     else if (status == NEW){
         if ( parse_gid(extra)){
-            fprintf(stdout, "%s successful. New group was created: %s.\n", command.c_str(), extra.c_str());
+            fprintf(stdout, "%.*s successful. New group was created: %.*s.\n", (int) command.size(), command.data(), 
+                (int) extra.size(), extra.data());
             return true;
         }
         else{
@@ -296,23 +673,28 @@ bool User::process_status(string status, string extra, string command){
         }
     }
     else if (status == E_USR){
-        fprintf(stdout, "%s unsuccessful. Invalid UID.\n", command.c_str());
+        fprintf(stdout, "%.*s unsuccessful. Invalid UID.\n", (int) command.size(), command.data());
         return false;
     }
     else if (status == E_GRP){
-        fprintf(stdout, "%s unsuccessful. Invalid GID.\n", command.c_str());
+        fprintf(stdout, "%.*s unsuccessful. Invalid GID.\n", (int) command.size(), command.data());
         return false;
     }
     else if (status == E_GNAME){
-        fprintf(stdout, "%s unsuccessful. Invalid GName.\n", command.c_str());
+        fprintf(stdout, "%.*s unsuccessful. Invalid GName.\n", (int) command.size(), command.data());
         return false;
     }
     else if (status == E_FULL){
-        fprintf(stdout, "%s unsusccessful. Too many groups.\n", command.c_str());
+        fprintf(stdout, "%.*s unsusccessful. Too many groups.\n", (int) command.size(), command.data());
+        return false;
+    }
+    else if (status == E_RANGE){
+        fprintf(stdout, "%.*s unsuccessful. The bytes asked for are past the end of the file.\n", (int) command.size(), command.data());
         return false;
     }
     else if ( parse_mid(status)){
-        fprintf(stdout, "%s successful. Message ID: %s\n", command.c_str(), status.c_str());
+        fprintf(stdout, "%.*s successful. Message ID: %.*s\n", (int) command.size(), command.data(), 
+            (int) status.size(), status.data());
         return true;
     }
     else if (status == EOF_){
@@ -376,34 +758,58 @@ bool User::check_not_logged_in(string command){
 
 //::::::::::::::::::::::::: PRINTERS :::::::::::::::::::::::::://
 /**
- * Prints groups from an already formatted vector of groups, 
- * while performing validation.
+ * Merges a page of groups from the words of an answer into a list
+ * of groups, while performing validation.
  * 
- * @param ans vector with groups. Each 3 entries represent a 
- * group.
- * Structure: RGL N[ GID GName MID]* or RGM N[ GID GName MID]*
+ * @param ans the words of the answer. Each 3 words after N 
+ * represent a group.
+ * Structure: RGD Version Since N[ GID GName MID]* or 
+ * RMD Version Since N[ GID GName MID]*
+ * @param offset the index of N in the words
+ * @param cache the list of groups
+ * @return int the number of groups of the page
  */
-void User::print_groups(vector<string> ans){
-    char output[MAX_STRING_UDP] = " GID |                     GName | MID\n";
-    int n = stoi(ans[1]);
-    char line[MAX_STRING] = {'\0'};
+int User::merge_groups(TOKENS * ans, int offset, GROUPCACHE * cache){
+    if ((ans->n <= offset) || ans->token[offset].empty() || (ans->token[offset].size() > 2) 
+        || !all_of_class(ans->token[offset], CLASS_DIGIT)){
+        handle_error(SERVER, PROTOCOL);
+    }
+    int n = to_number(ans->token[offset]);
+    if (ans->n != 3*n + offset + 1){
+        handle_error(SERVER, PROTOCOL);
+    }
 
-    for(int i = 2; i <= 3*n; i+=3){
-        if(! parse_gid(ans[i])){
+    for(int i = offset + 1; i < ans->n; i+=3){
+        if(! parse_gid(ans->token[i]) || (ans->token[i] == "00")){
             handle_error(SERVER, PROTOCOL);
         }
-        if(! parse_gname(ans[i+1])){
+        if(! parse_gname(ans->token[i+1])){
             handle_error(SERVER, PROTOCOL);
         }
 
-        if(! parse_mid(ans[i+2])){
+        if(! parse_mid(ans->token[i+2])){
             handle_error(SERVER, PROTOCOL);
         }
-        sprintf(line, "%4s |  %24s | %s\n", ans[i].c_str(), ans[i+1].c_str(), ans[i+2].c_str());
-        strcat(output, line);
+        int g = to_number(ans->token[i]) - 1;
+        memcpy(cache->group_name[g], ans->token[i+1].data(), ans->token[i+1].size());
+        cache->group_name[g][ans->token[i+1].size()] = '\0';
+        memcpy(cache->group_mid[g], ans->token[i+2].data(), MAX_MID);
+    }
+    return n;
+}
 
+/**
+ * Prints a list of groups.
+ * 
+ * @param cache the list of groups
+ */
+void User::print_groups(GROUPCACHE * cache){
+    fprintf(stdout, " GID |                     GName | MID\n");
+    for (int i = 0; i < MAX_NGROUPS; i++){
+        if (cache->group_name[i][0] != '\0'){
+            fprintf(stdout, "  %02d |  %24s | %s\n", i + 1, cache->group_name[i], cache->group_mid[i]);
+        }
     }
-    fprintf(stdout, "%s", output);
 }
 
 //::::::::::::::::::::::::: COMMANDS :::::::::::::::::::::::::://
@@ -425,7 +831,6 @@ void User::print_groups(vector<string> ans){
  * @param pass the pass parameter
  */
 void User::reg(string uid, string pass){
-    string buffer;
     char answer[MAX_STRING] = {'\0'};
 
     /* 1. Parameters verification */
@@ -436,12 +841,12 @@ void User::reg(string uid, string pass){
      * 2. Construct and send message; get answer 
      * Format: REG UID pass
     */
-    buffer = string(USER_REG_REQUEST) + " " + uid + " " + pass + "\n" ;
+    const char * fields[] = {uid.c_str(), pass.c_str()};
 
-    if (sendUDP(socketUDP, buffer) == FAIL){
+    if (send_requestUDP(USER_REG_REQUEST, fields) == FAIL){
         return;
     }
-    if (receiveUDP(socketUDP, answer) == FAIL){
+    if (receive_answerUDP(answer, sizeof(answer) - 1) == FAIL){
         return;
     }
 
@@ -449,16 +854,17 @@ void User::reg(string uid, string pass){
      * 3. Process and display result 
      * Format: RRG status
     */
-    vector<string> ans = process_string(string(answer));
-    string header = ans[0];
+    TOKENS ans;
+    split_string(answer, &ans);
+    string_view header = ans.token[0];
 
     if (header == ERR){
         handle_error(SERVER, PROTOCOL);
     }
-    if ((header != USER_REG_ANSWER) || (ans.size() != 2)){
+    if ((header != USER_REG_ANSWER) || (ans.n != 2)){
         handle_error(SERVER, PROTOCOL);
     }
-    string status = ans[1];
+    string_view status = ans.token[1];
     process_status(status, "", USER_REG);
 }
 
@@ -474,7 +880,6 @@ void User::reg(string uid, string pass){
  * @param pass the pass parameter
  */
 void User::unregister(string uid, string pass){
-    string buffer;
     char answer[MAX_STRING] = {'\0'};
     
     /* 1. Parameters verification */
@@ -491,12 +896,12 @@ void User::unregister(string uid, string pass){
      * 3. Construct and send message; get answer 
      * Format: UNR UID pass
     */
-    buffer = string(USER_UNREGISTER_REQUEST) + " " + uid + " " + pass + "\n";
+    const char * fields[] = {uid.c_str(), pass.c_str()};
 
-    if (sendUDP(socketUDP, buffer) == FAIL){
+    if (send_requestUDP(USER_UNREGISTER_REQUEST, fields) == FAIL){
         return;
     }
-    if (receiveUDP(socketUDP, answer) == FAIL){
+    if (receive_answerUDP(answer, sizeof(answer) - 1) == FAIL){
         return;
     }
 
@@ -504,16 +909,17 @@ void User::unregister(string uid, string pass){
      * 4. Process and display result 
      * Format: RUN status
     */
-    vector<string> ans = process_string(string(answer));
-    string header = ans[0];
+    TOKENS ans;
+    split_string(answer, &ans);
+    string_view header = ans.token[0];
 
     if (header == ERR){
         handle_error(SERVER, PROTOCOL);
     }
-    if ((header != USER_UNREGISTER_ANSWER) || (ans.size() != 2)){
+    if ((header != USER_UNREGISTER_ANSWER) || (ans.n != 2)){
         handle_error(SERVER, PROTOCOL);
     }
-    string status = ans[1];
+    string_view status = ans.token[1];
     process_status(status, "", USER_UNREGISTER);
 }
 
@@ -538,7 +944,6 @@ void User::unregister(string uid, string pass){
  * @param pass the pass parameter
  */
 void User::login(string uid, string pass){
-    string buffer;
     char answer[MAX_STRING] = {'\0'};
 
     /* 1. Parameters verification */
@@ -552,12 +957,12 @@ void User::login(string uid, string pass){
      * 3. Construct and send message; get answer 
      * Format: LOG UID pass
     */
-    buffer = string(USER_LOGIN_REQUEST) + " " + uid + " " + pass + "\n";
+    const char * fields[] = {uid.c_str(), pass.c_str()};
 
-    if (sendUDP(socketUDP, buffer) == FAIL){
+    if (send_requestUDP(USER_LOGIN_REQUEST, fields) == FAIL){
         return;
     }
-    if (receiveUDP(socketUDP, answer) == FAIL){
+    if (receive_answerUDP(answer, sizeof(answer) - 1) == FAIL){
         return;
     }
 
@@ -565,21 +970,24 @@ void User::login(string uid, string pass){
      * 4. Process and display result 
      * Format: RLO status
     */
-    vector<string> ans = process_string(string(answer));
-    string header = ans[0];
+    TOKENS ans;
+    split_string(answer, &ans);
+    string_view header = ans.token[0];
 
     if (header == ERR){
         handle_error(SERVER, PROTOCOL);
     }
-    if ((header != USER_LOGIN_ANSWER) || (ans.size() != 2)){
+    if ((header != USER_LOGIN_ANSWER) || (ans.n != 2)){
         handle_error(SERVER, PROTOCOL);
     }
-    string status = ans[1];
+    string_view status = ans.token[1];
     if (!process_status(status, "", USER_LOGIN)){
         return;
     }
     m_uid = uid;
+    m_inbox_next = 0;
     m_pass = pass;
+    memset(&m_my_groups, 0, sizeof(GROUPCACHE));
 }
 
 /**
@@ -590,7 +998,6 @@ void User::login(string uid, string pass){
  *
  */
 void User::logout(){
-    string buffer;
     char answer[MAX_STRING] = {'\0'};
 
     /* 1. Conditions for valid logout verification */
@@ -600,12 +1007,12 @@ void User::logout(){
      * 2. Construct and send message; get answer 
      * Format: OUT UID pass
     */
-    buffer = string(USER_LOGOUT_REQUEST) + " " + m_uid + " " + m_pass + "\n";
+    const char * fields[] = {m_uid.c_str(), m_pass.c_str()};
 
-    if (sendUDP(socketUDP, buffer) == FAIL){
+    if (send_requestUDP(USER_LOGOUT_REQUEST, fields) == FAIL){
         return;
     }
-    if (receiveUDP(socketUDP, answer) == FAIL){
+    if (receive_answerUDP(answer, sizeof(answer) - 1) == FAIL){
         return;
     }
 
@@ -613,21 +1020,23 @@ void User::logout(){
      * 3. Process and display result 
      * Format: ROU status
     */
-    vector<string> ans = process_string(string(answer));
-    string header = ans[0];
+    TOKENS ans;
+    split_string(answer, &ans);
+    string_view header = ans.token[0];
 
     if (header == ERR){
         handle_error(SERVER, PROTOCOL);
     }
-    if ((header != USER_LOGOUT_ANSWER) || (ans.size() != 2)){
+    if ((header != USER_LOGOUT_ANSWER) || (ans.n != 2)){
         handle_error(SERVER, PROTOCOL);
     }
-    string status = ans[1];
+    string_view status = ans.token[1];
     if (!process_status(status, "", USER_LOGOUT)){
         return;
     }
     m_uid = "";
     m_pass = "";
+    memset(&m_my_groups, 0, sizeof(GROUPCACHE));
 }
 
 /**
@@ -675,36 +1084,7 @@ void User::usr_exit(){
  * 
  */
 void User::groups(){
-    string buffer;
-    char answer[MAX_STRING_UDP] = {'\0'};
-
-    /** 
-     * 1. Construct and send message; get answer 
-     * Format: GLS
-    */
-    buffer = string(USER_GROUPS_REQUEST) + "\n";
-
-    if (sendUDP(socketUDP, buffer) == FAIL){
-        return;
-    }
-    if (receiveUDP(socketUDP, answer) == FAIL){
-        return;
-    }
-
-    /** 
-     * 2. Process and display result 
-     * Format: RGL N[ GID GName MID]*
-    */
-    vector<string> ans = process_string(string(answer));
-    string header = ans[0];
-
-    if (header == ERR){
-        handle_error(SERVER, PROTOCOL);
-    }
-    if (header != USER_GROUPS_ANSWER){
-        handle_error(SERVER, PROTOCOL);
-    }
-    print_groups(ans);
+    list_groups(USER_GROUPS_DELTA_REQUEST, USER_GROUPS_DELTA_ANSWER, NULL, &m_groups);
 }
 
 /**
@@ -721,7 +1101,6 @@ void User::groups(){
  * @param gname the GName parameter
  */
 void User::subscribe(string gid, string gname){
-    string buffer;
     char answer[MAX_STRING] = {'\0'};
 
     /* 1. Parameters verification */
@@ -735,12 +1114,12 @@ void User::subscribe(string gid, string gname){
      * 3. Construct and send message; get answer 
      * Format: GSR UID GID GName
      */
-    buffer = string(USER_SUBSCRIBE_REQUEST) + " " + m_uid + " " + gid + " " + gname + "\n";
+    const char * fields[] = {m_uid.c_str(), gid.c_str(), gname.c_str()};
 
-    if (sendUDP(socketUDP, buffer) == FAIL){
+    if (send_requestUDP(USER_SUBSCRIBE_REQUEST, fields) == FAIL){
         return;
     }
-    if (receiveUDP(socketUDP, answer) == FAIL){
+    if (receive_answerUDP(answer, sizeof(answer) - 1) == FAIL){
         return;
     }
 
@@ -748,8 +1127,9 @@ void User::subscribe(string gid, string gname){
      * 4. Process and display result 
      * Format: RGS status
     */
-    vector<string> ans = process_string(string(answer));
-    string header = ans[0];
+    TOKENS ans;
+    split_string(answer, &ans);
+    string_view header = ans.token[0];
 
     if (header == ERR){
         handle_error(SERVER, PROTOCOL);
@@ -757,11 +1137,11 @@ void User::subscribe(string gid, string gname){
     if (header != USER_SUBSCRIBE_ANSWER){
         handle_error(SERVER, PROTOCOL);
     }
-    string status = ans[1];
-    if (ans.size() == 3){
-        gid = ans[2];
+    string_view status = ans.token[1];
+    if (ans.n == 3){
+        gid = string(ans.token[2]);
     } 
-    else if (ans.size() != 2){
+    else if (ans.n != 2){
         handle_error(SERVER, PROTOCOL);
     }
     process_status(status, gid, USER_SUBSCRIBE);
@@ -777,7 +1157,6 @@ void User::subscribe(string gid, string gname){
  * @param gid the GID parameter
  */
 void User::unsubscribe(string gid){
-    string buffer;
     char answer[MAX_STRING] = {'\0'};
 
     /* 1. Parameters verification */
@@ -790,12 +1169,12 @@ void User::unsubscribe(string gid){
      * 3. Construct and send message; get answer 
      * Format: GUR UID GID
      */
-    buffer = string(USER_UNSUBSCRIBE_REQUEST) + " " + m_uid + " " + gid + "\n";
+    const char * fields[] = {m_uid.c_str(), gid.c_str()};
 
-    if (sendUDP(socketUDP, buffer) == FAIL){
+    if (send_requestUDP(USER_UNSUBSCRIBE_REQUEST, fields) == FAIL){
         return;
     }
-    if (receiveUDP(socketUDP, answer) == FAIL){
+    if (receive_answerUDP(answer, sizeof(answer) - 1) == FAIL){
         return;
     }
 
@@ -803,16 +1182,17 @@ void User::unsubscribe(string gid){
      * 4. Process and display result 
      * Format: RGU status
      */
-    vector<string> ans = process_string(string(answer));
-    string header = ans[0];
+    TOKENS ans;
+    split_string(answer, &ans);
+    string_view header = ans.token[0];
 
     if (header == ERR){
         handle_error(SERVER, PROTOCOL);
     }
-    if ((header != USER_UNSUBSCRIBE_ANSWER) || (ans.size() != 2)){
+    if ((header != USER_UNSUBSCRIBE_ANSWER) || (ans.n != 2)){
         handle_error(SERVER, PROTOCOL);
     }
-    string status = ans[1];
+    string_view status = ans.token[1];
     process_status(status, "", USER_UNSUBSCRIBE);
 }
 
@@ -825,64 +1205,139 @@ void User::unsubscribe(string gid){
  * 
  */
 void User::my_groups(){
-    string buffer;
-    char answer[MAX_STRING_UDP] = {'\0'};
-
     /* 1. Conditions for valid my_groups verification */
     if (!check_logged_in(USER_MY_GROUPS)) return;
 
-    /**
-     * 2. Construct and send message; get answer 
-     * Format: GLM UID
-     */
-    buffer = string(USER_MY_GROUPS_REQUEST) + " " + m_uid + "\n";
-
-    if (sendUDP(socketUDP, buffer) == FAIL){
-        return;
-    }
-    if (receiveUDP(socketUDP, answer) == FAIL){
-        return;
-    }
-
-    /**
-     * 3. Process and display result 
-     * Format: RGM N[ GID GName MID]*
-     */
-    vector<string> ans = process_string(string(answer));
-    string header = ans[0];
-
-    if (header == ERR){
-        handle_error(SERVER, PROTOCOL);
-    }
-    if (header != USER_MY_GROUPS_ANSWER){
-        handle_error(SERVER, PROTOCOL);
-    }
-    print_groups(ans);
+    list_groups(USER_MY_GROUPS_DELTA_REQUEST, USER_MY_GROUPS_DELTA_ANSWER, m_uid.c_str(), &m_my_groups);
 }
 
 /**
- * select GID or sag GID
- * Following this command the User application locally memorizes
- * GID as the ID of the active group. Subsequent ulist, post and
- * retrieve messaging commands refer to this GID.
+ * Gets a list of groups from the DS server, a page of at most 
+ * GROUPS_PAGE groups at a time, so that each answer fits a sin-
+ * gle unfragmented datagram however many groups there are. Each
+ * page starts after the last GID of the previous one.
+ * Only the groups which changed since the catalog version of the
+ * cached list are sent, and merged into it: an unchanged catalog
+ * costs a single answer with N = 0.
  * 
- * @param gid the GID parameter
+ * @param request the request code: GLD or GMD
+ * @param answer the expected answer code: RGD or RMD
+ * @param uid the UID parameter (GMD only), or NULL
+ * @param cache the cached list of groups
  */
-void User::usr_select(string gid){
-    /* 1. Parameters verification */
-    if (!check_gid(gid, USER_SELECT)) return;
+void User::list_groups(const char * request, const char * answer, const char * uid, GROUPCACHE * cache){
+    char version[MAX_STRING] = {'\0'};
+    char first[MAX_GID + 1] = {'\0'};
+    char count[MAX_N + 1] = {'\0'};
+    long since = cache->version;
+    long listed = 0;
+    int next = 1;
+    int n;
+
+    sprintf(count, "%02d", GROUPS_PAGE);
+    do {
+        char message[MAX_STRING_UDP] = {'\0'};
+
+        /**
+         * 1. Construct and send message; get answer
+         * Format: GLD Version First Count or 
+         * GMD UID Version First Count
+         */
+        sprintf(version, "%ld", since);
+        sprintf(first, "%02u", (unsigned) next % 100);
+        const char * all_fields[] = {version, first, count};
+        const char * my_fields[] = {uid, version, first, count};
+
+        if (send_requestUDP(request, (uid == NULL) ? all_fields : my_fields) == FAIL){
+            return;
+        }
+        if (receive_answerUDP(message, sizeof(message) - 1) == FAIL){
+            return;
+        }
 
-    /* 2. Conditions for valid select verification */
-    if (!check_logged_in(USER_SELECT)) return;
-    
-    /* 3. Display result */
-    m_gid = gid;
-    fprintf(stdout, "selected group %s successfully.\n", m_gid.c_str());
-}
+        /**
+         * 2. Process result
+         * Format: RGD Version Since N[ GID GName MID]* or 
+         * RMD Version Since N[ GID GName MID]*
+         */
+        TOKENS ans;
+        split_string(message, &ans);
+        string_view header = ans.token[0];
 
-/**
- * showgid or sg
- * Following this command the User application locslly displays 
+        if (header == ERR){
+            handle_error(SERVER, PROTOCOL);
+        }
+        if (header != answer){
+            handle_error(SERVER, PROTOCOL);
+        }
+        if ((ans.n == 2) && (ans.token[1] == E_USR)){
+            process_status(E_USR, "", USER_MY_GROUPS);
+            return;
+        }
+        if ((ans.n < 4) || !parse_version(ans.token[1]) || !parse_version(ans.token[2])){
+            handle_error(SERVER, PROTOCOL);
+        }
+        long relative = to_number(ans.token[2]);
+        if ((relative != since) && (relative != 0)){
+            handle_error(SERVER, PROTOCOL);
+        }
+
+        /* The DS sent the whole list instead (the subscriptions 
+        changed): it replaces the cached one, from the first page */
+        if (relative != since){
+            since = 0;
+            memset(cache, 0, sizeof(GROUPCACHE));
+            if (next != 1){
+                next = 1;
+                n = GROUPS_PAGE;
+                continue;
+            }
+        }
+        if (next == 1){
+            listed = to_number(ans.token[1]);
+        }
+
+        n = merge_groups(&ans, 3, cache);
+        if (n == 0){
+            break;
+        }
+
+        /* The pages must advance, or we'd ask for the same one */
+        int last = to_number(ans.token[3*n + 1]);
+        if ((n > GROUPS_PAGE) || (last < next)){
+            handle_error(SERVER, PROTOCOL);
+        }
+        next = last + 1;
+    } while ((n == GROUPS_PAGE) && (next <= MAX_NGROUPS));
+
+    /* 3. Display result */
+    cache->version = listed;
+    print_groups(cache);
+}
+
+/**
+ * select GID or sag GID
+ * Following this command the User application locally memorizes
+ * GID as the ID of the active group. Subsequent ulist, post and
+ * retrieve messaging commands refer to this GID.
+ * 
+ * @param gid the GID parameter
+ */
+void User::usr_select(string gid){
+    /* 1. Parameters verification */
+    if (!check_gid(gid, USER_SELECT)) return;
+
+    /* 2. Conditions for valid select verification */
+    if (!check_logged_in(USER_SELECT)) return;
+    
+    /* 3. Display result */
+    m_gid = gid;
+    fprintf(stdout, "selected group %s successfully.\n", m_gid.c_str());
+}
+
+/**
+ * showgid or sg
+ * Following this command the User application locslly displays 
  * the GID of the selected group.
  * 
  */
@@ -910,15 +1365,24 @@ void User::ulist(){
     if (!check_selected(USER_ULIST)) return;
 
     /* 2. Establish TCP connection */
-    connectTCP(m_dsip, m_dsport);
+    if (open_session() == FAIL) return;
     
     /**
      * 3. Construct and send message
      * Format: ULS GID
      */
-    buffer = string(USER_ULIST_REQUEST) + " " + m_gid + "\n";
+    int sent;
+    if (m_framed){
+        put_field(buffer, m_gid, MAX_GID);
+        sent = send_frame(FRAME_ULIST, buffer, 0);
+    }
+    else{
+        buffer = string(USER_ULIST_REQUEST) + " " + m_gid + "\n";
+        sent = sendTCP(socketTCP, buffer, buffer.size());
+    }
 
-    if(sendTCP(socketTCP, buffer, buffer.size()) == FAIL){
+    if(sent == FAIL){
+        disconnectTCP();
         return;
     }
 
@@ -929,44 +1393,33 @@ void User::ulist(){
      */
     /**
      * 4.1. Get, process and display RUL status
-     * Possible formats: "RUL OK "; "RUL NOK"
+     * Possible formats: "RUL OK "; "RUL NOK\n"
      */
-    char answer_head[MAX_ANS_HEAD] = {'\0'};
-    if (receiveTCP(socketTCP, answer_head, MAX_ANS_HEAD) == FAIL){
-        disconnect(socketTCP);
+    int res = receive_statusTCP(USER_ULIST_ANSWER, USER_ULIST, NULL);
+    if (res == FAIL) return;
+    if (!res){
+        close_session();
         return;
     }
 
-    vector<string> ans = process_string(string(answer_head));
-    string header = ans[0];
-
-    if (header == ERR){
-        handle_error(SERVER, PROTOCOL);
-    }
-    if (header != USER_ULIST_ANSWER){
-        handle_error(SERVER, PROTOCOL);
-    }
-    string status = ans[1];
-    if (!process_status(status, "", USER_ULIST)) {
-        disconnect(socketTCP);
+    /* 4.2. Get, process and display GName */
+    char answer_gname[MAX_GNAME + 2] = {'\0'};
+    char delimiter = '\0';
+    word_receiveTCP(socketTCP, answer_gname, MAX_GNAME + 1, &delimiter);
+    if (!parse_gname(answer_gname)){
+        disconnectTCP();
         return;
     }
 
-    /* 4.2. Get, process and display GName */
-    char answer_gname[MAX_GNAME + 1] = {'\0'};
-    if (!gname_receiveTCP(socketTCP, answer_gname, USER_ULIST)) return;
-
     fprintf(stdout, "Group: %s\n", answer_gname);
 
-    /* 4.3. Get, process and display [UID ]* */
+    /* 4.3. Get, process and display [UID ]*, until the '\n' */
     int n_subscribers = 0;
-    while (true){
-        char answer_uid[MAX_UID + 1] = {'\0'};
-        int res = uid_receiveTCP(socketTCP, answer_uid, USER_ULIST);
-        if (!res){
-            break;
-        }
-        if (res == FAIL){
+    while (delimiter == ' '){
+        char answer_uid[MAX_UID + 2] = {'\0'};
+        word_receiveTCP(socketTCP, answer_uid, MAX_UID + 1, &delimiter);
+        if (!parse_uid(answer_uid)){
+            disconnectTCP();
             return;
         }
 
@@ -980,7 +1433,7 @@ void User::ulist(){
     else{
         fprintf(stdout, "Total: %d subscribers.\n",n_subscribers);
     }
-    disconnect(socketTCP);
+    close_session();
 }
 
 /**
@@ -1007,7 +1460,6 @@ void User::ulist(){
  */
 void User::post(string text, string fname, int nparams){
     string buffer;
-    char answer[MAX_STRING_TCP] = {'\0'};
 
     /* 1. Parameters verification */
     if (!check_text(text, USER_POST)) return;
@@ -1022,96 +1474,256 @@ void User::post(string text, string fname, int nparams){
     if (!check_logged_in(USER_POST)) return;
     if (!check_selected(USER_POST)) return;
 
+    if (m_chunked && !fname.empty()){
+        upload(text, fname);
+        return;
+    }
+
     /* 3. Establish TCP connection */
-    connectTCP(m_dsip, m_dsport);
+    if (open_session() == FAIL) return;
 
     /**
      * 4. Construct and send message; get answer 
      * Format: PST UID GID Tsize text [Fname Fsize data]
      */
-    /* First "half" of the request: PST UID GID Tsize text */
-    buffer = string(USER_POST_REQUEST) + " " + m_uid + " " + m_gid + " " + to_string(text.size()) + " " + text;
-
-    /* If there's no file to send, the message is complete */
-    if (fname.empty()){
-        buffer += "\n";
-
-        if(sendTCP(socketTCP, buffer, buffer.size()) == FAIL){
-            disconnect(socketTCP);
-            return;
-        }
-    }
-    /* Else add Fname Fsize data to the request and send */
-    else {
-        FILE * file;
+    FILE * file = NULL;
+    int fsize = 0;
+    if (!fname.empty()){
         file = fopen(fname.c_str(), "rb");
         if (!file){
-            disconnect(socketTCP);
             fprintf(stderr, "Unable to open file.\n");
-            disconnect(socketTCP);
+            close_session();
             return;
         }
 
         /* Get Fsize */
         fseek(file, 0, SEEK_END);
-        int fsize = ftell(file);
+        fsize = ftell(file);
         fseek(file, 0, SEEK_SET);
 
         /* Ensure file isn't too big */
         if (!parse_fsize(to_string(fsize))){
             fprintf(stderr, "Invalid file size.\n");
             fclose(file);
-            disconnect(socketTCP);
+            close_session();
             return;
         }
-        
-        /* Send PST UID GID Tsize text Fname Fsize */
-        buffer += " " + fname + " " + to_string(fsize) + " ";
-        if(sendTCP(socketTCP, buffer, buffer.size()) == FAIL){
-            fclose(file);
-            disconnect(socketTCP);
-            return;
+    }
+
+    int sent;
+    if (m_framed){
+        /* Format: UID GID Tsize Fname Fsize text; the data follows */
+        put_field(buffer, m_uid, MAX_UID);
+        put_field(buffer, m_gid, MAX_GID);
+        put_uint(buffer, text.size(), 2);
+        put_field(buffer, fname, MAX_FNAME);
+        put_uint(buffer, fsize, 4);
+        buffer += text;
+        sent = send_frame(FRAME_POST, buffer, fsize);
+    }
+    else{
+        /* First "half" of the request: PST UID GID Tsize text */
+        buffer = string(USER_POST_REQUEST) + " " + m_uid + " " + m_gid + " " + to_string(text.size()) + " " + text;
+
+        /* If there's no file to send, the message is complete; 
+        else add Fname Fsize (the data follows) */
+        if (!file){
+            buffer += "\n";
+        }
+        else{
+            buffer += " " + fname + " " + to_string(fsize) + " ";
         }
+        sent = sendTCP(socketTCP, buffer, buffer.size());
+    }
 
+    if(sent == FAIL){
+        if (file) fclose(file);
+        disconnectTCP();
+        return;
+    }
+
+    if (file){
         /* Send file data */
         if (sendfileTCP(socketTCP, file) == FAIL){
             fclose(file);
-            disconnect(socketTCP);
+            disconnectTCP();
             return;
         }
 
-        /* Send '\n' (end of message) */
-        if(sendTCP(socketTCP, "\n", 1) == FAIL){
+        /* Send '\n' (end of a text message) */
+        if(!m_framed && (sendTCP(socketTCP, "\n", 1) == FAIL)){
             fclose(file);
-            disconnect(socketTCP);
+            disconnectTCP();
             return;
         }
 
         fclose(file);
     }
 
-    if(receiveTCP(socketTCP, answer, MAX_STRING_TCP) == FAIL){
-        disconnect(socketTCP);
+    /**
+     * 5. Get, process and display result 
+     * Format: RPT status
+     */
+    int res = receive_statusTCP(USER_POST_ANSWER, USER_POST, NULL);
+    if (res == FAIL) return;
+
+    /* The DS ends the session when a post fails */
+    if (!res){
+        disconnectTCP();
         return;
     }
+    close_session();
+}
 
-    disconnect(socketTCP);
+/**
+ * Posts a message with a file through an upload (-u). Its requests
+ * are text ones, sharing one persistent session (as with -k), so 
+ * the chunks aren't held back by the limit on new sessions.
+ * 
+ * @param text the text of the message
+ * @param fname the name of the file
+ */
+void User::upload(string text, string fname){
+    bool keepalive = m_keepalive, framed = m_framed;
+    m_keepalive = true;
+    m_framed = false;
+    upload_chunks(text, fname);
+    m_keepalive = keepalive;
+    m_framed = framed;
+    close_session();
+}
+
+/**
+ * Sends the requests of an upload: the DS gets the text and the 
+ * name and size of the file first, and gives it an upload ID; the
+ * data follows in chunks of UPLOAD_CHUNK bytes, each one answered
+ * with the number of bytes the DS holds. Once it holds them all,
+ * the upload is committed, which posts the message.
+ * If the post breaks, the upload is kept: posting the same mes-
+ * sage again asks the DS how many bytes it holds, and only sends
+ * the ones after them.
+ * 
+ * @param text the text of the message
+ * @param fname the name of the file
+ */
+void User::upload_chunks(string text, string fname){
+    struct stat info;
+    if (stat(fname.c_str(), &info) == FAIL){
+        fprintf(stderr, "Unable to open file.\n");
+        return;
+    }
+    long fsize = info.st_size;
+    if (!parse_fsize(to_string(fsize))){
+        fprintf(stderr, "Invalid file size.\n");
+        return;
+    }
 
     /**
-     * 5. Process and display result 
-     * Format: RPT status
+     * 1. Resume the broken upload of the same message, or open a 
+     * new one
+     * Format: UPQ UID ID, answered with RUQ OK Received; or UPO UID
+     * GID Tsize text Fname Fsize, answered with RUO OK ID
      */
-    vector<string> ans = process_string(string(answer));
-    string header = ans[0];
+    long received = FAIL;
+    string buffer;
+    bool resumed = (m_upload.id != "") && (m_upload.gid == m_gid) && (m_upload.text == text) 
+        && (m_upload.fname == fname) && (m_upload.fsize == fsize);
+    if (resumed){
+        if (open_session() == FAIL) return;
+        buffer = string(USER_UPLOAD_QUERY_REQUEST) + " " + m_uid + " " + m_upload.id + "\n";
+        if (sendTCP(socketTCP, buffer, buffer.size()) == FAIL){
+            disconnectTCP();
+            return;
+        }
+        received = receive_countTCP(USER_UPLOAD_QUERY_ANSWER);
+        if (socketTCP == NULL) return;
+        close_session();
+    }
+    if (received == FAIL){
+        if (open_session() == FAIL) return;
+        buffer = string(USER_UPLOAD_OPEN_REQUEST) + " " + m_uid + " " + m_gid + " " + to_string(text.size()) + " " 
+            + text + " " + fname + " " + to_string(fsize) + "\n";
+        if (sendTCP(socketTCP, buffer, buffer.size()) == FAIL){
+            disconnectTCP();
+            return;
+        }
 
-    if (header == ERR){
-        handle_error(SERVER, PROTOCOL);
+        char header[MAX_STRING] = {'\0'};
+        char status[MAX_STRING] = {'\0'};
+        char id[MAX_UPLOAD_ID + 2] = {'\0'};
+        word_receiveTCP(socketTCP, header, MAX_HEAD_TCP);
+        if (busy(header)){
+            disconnectTCP();
+            return;
+        }
+        word_receiveTCP(socketTCP, status, MAX_STRING - 1);
+        if (strcmp(header, USER_UPLOAD_OPEN_ANSWER)){
+            handle_error(SERVER, PROTOCOL);
+        }
+        if (strcmp(status, OK)){
+            process_status(status, "", USER_POST);
+            close_session();
+            return;
+        }
+        word_receiveTCP(socketTCP, id, MAX_UPLOAD_ID + 1);
+        if ((strlen(id) != MAX_UPLOAD_ID) || !all_of_class(id, CLASS_DIGIT)){
+            handle_error(SERVER, PROTOCOL);
+        }
+        close_session();
+
+        m_upload = {string(id), m_gid, text, fname, fsize};
+        received = 0;
     }
-    if ((header != USER_POST_ANSWER) || (ans.size() != 2)){
-        handle_error(SERVER, PROTOCOL);
+    else{
+        fprintf(stdout, "Resuming the upload of %s: the DS has %ld of %ld bytes.\n", fname.c_str(), received, fsize);
+    }
+
+    /**
+     * 2. Send the chunks
+     * Format: UPC UID ID Offset Size data, answered with RUC OK 
+     * Received
+     */
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd == FAIL){
+        fprintf(stderr, "Unable to open file.\n");
+        return;
+    }
+    while (received < fsize){
+        long n = min(fsize - received, (long) UPLOAD_CHUNK);
+        bool connected = (open_session() != FAIL);
+        buffer = string(USER_UPLOAD_CHUNK_REQUEST) + " " + m_uid + " " + m_upload.id + " " + to_string(received) + " " 
+            + to_string(n) + " ";
+        long now = FAIL;
+        if (connected && (sendTCP(socketTCP, buffer, buffer.size()) != FAIL) && (sendrangeTCP(socketTCP, fd, received, n) != FAIL)
+            && (sendTCP(socketTCP, "\n", 1) != FAIL)){
+            now = receive_countTCP(USER_UPLOAD_CHUNK_ANSWER);
+        }
+        if (now == FAIL){
+            fprintf(stdout, "post interrupted. The DS has %ld of %ld bytes: post the same message again to resume.\n", 
+                received, fsize);
+            close(fd);
+            disconnectTCP();
+            return;
+        }
+        received = now;
+        close_session();
+    }
+    close(fd);
+
+    /**
+     * 3. Commit the upload
+     * Format: UPF UID ID, answered with RUF status (the MID)
+     */
+    if (open_session() == FAIL) return;
+    buffer = string(USER_UPLOAD_COMMIT_REQUEST) + " " + m_uid + " " + m_upload.id + "\n";
+    if (sendTCP(socketTCP, buffer, buffer.size()) == FAIL){
+        disconnectTCP();
+        return;
     }
-    string status = ans[1];
-    process_status(status, "", USER_POST);
+    int res = receive_statusTCP(USER_UPLOAD_COMMIT_ANSWER, USER_POST, NULL);
+    if (res == FAIL) return;
+    m_upload.id = "";
+    close_session();
 }
 
 /**
@@ -1140,16 +1752,26 @@ void User::retrieve(string mid){
     if (!check_selected(USER_RETRIEVE)) return;
 
     /* 3. Establish TCP connection */
-    connectTCP(m_dsip, m_dsport);
+    if (open_session() == FAIL) return;
 
     /** 
      * 4. Construct and send message
-     * Format: RTV UID GID MID
+     * Format: RTV UID GID MID or RTM UID GID MID (-m)
     */
-    buffer = string(USER_RETRIEVE_REQUEST) + " " + m_uid + " " + m_gid + " " + mid + "\n";
+    int sent;
+    if (m_framed){
+        put_field(buffer, m_uid, MAX_UID);
+        put_field(buffer, m_gid, MAX_GID);
+        put_field(buffer, mid, MAX_MID);
+        sent = send_frame(FRAME_RETRIEVE, buffer, 0, m_meta ? FRAME_META : 0);
+    }
+    else{
+        buffer = string(m_meta ? USER_RETRIEVE_META_REQUEST : USER_RETRIEVE_REQUEST) + " " + m_uid + " " + m_gid + " " + mid + "\n";
+        sent = sendTCP(socketTCP, buffer, buffer.size());
+    }
 
-    if(sendTCP(socketTCP, buffer, buffer.size()) == FAIL){
-        disconnect(socketTCP);
+    if(sent == FAIL){
+        disconnectTCP();
         return;
     }
 
@@ -1160,197 +1782,610 @@ void User::retrieve(string mid){
      */
 
     /**
-     * 5.1. Get RRT status
-     * Possible formats: "RRT OK "; "RRT EOF"; "RRT NOK"
+     * 5.1. Get, process and display RRT status
+     * Possible formats: "RRT OK "; "RRT EOF\n"; "RRT NOK\n"
      */
-    char answer_head[MAX_ANS_HEAD] = {'\0'};
+    int res = receive_statusTCP(m_meta ? USER_RETRIEVE_META_ANSWER : USER_RETRIEVE_ANSWER, USER_RETRIEVE, NULL);
+    if (res == FAIL) return;
+    if (!res){
+        close_session();
+        return;
+    }
 
-    if(receiveTCP(socketTCP, answer_head, MAX_ANS_HEAD) == FAIL){
-        disconnect(socketTCP);
+    /**
+     * If status is OK we need to read the rest of the answer
+     * Format: [N[ MID UID Tsize text[ / Fname Fsize data]]*]
+     */
+
+    /* 5.2. Get N (0 =< N =< 20) */
+    char answer_N[MAX_N + 2] = {'\0'};
+    word_receiveTCP(socketTCP, answer_N, MAX_N + 1);
+    int N = atoi(answer_N);
+    
+    /* If N is 0, there are no messages */
+    if (N == 0){
+        fprintf(stdout, "There are no messages available.\n");
+        close_session();
         return;
     }
-    /** 
-     * 5.1.1. Process first stage and display result 
+
+    /* 5.3. Get and display the N messages */
+    receive_messages(N, false, !m_meta);
+}
+
+/**
+ * history N or hs N
+ * Following this command the User gets every message of the ac-
+ * tive group GID, from the first one to the last one, asking the
+ * DS server for pages of N (up to 50) messages. Each answer car-
+ * ries the cursor of the next page, which is sent back as is.
+ * The messages are displayed like the ones of retrieve. After the
+ * first page, running out of messages (EOF) only means the last 
+ * page was full, so it isn't displayed.
+ * 
+ * @param count the N parameter
+ */
+void User::history(string count){
+    /* 1. Parameters verification */
+    if (!check_count(count, MAX_PAGE, USER_HISTORY)) return;
+
+    /* 2. Conditions for valid history verification */
+    if (!check_logged_in(USER_HISTORY)) return;
+    if (!check_selected(USER_HISTORY)) return;
+
+    char N_str[MAX_N + 1] = {'\0'};
+    sprintf(N_str, "%02u", (unsigned) to_number(count) % 100);
+    string cursor = "0000";
+    bool first = true;
+    int N = 0;
+    do {
+        /* 3. Establish TCP connection */
+        if (open_session() == FAIL) return;
+
+        /**
+         * 4. Construct and send message
+         * Format: RTP UID GID Cursor Count
+         */
+        string buffer = string(USER_RETRIEVE_PAGE_REQUEST) + " " + m_uid + " " + m_gid + " " + cursor + " " + string(N_str) + "\n";
+        if (sendTCP(socketTCP, buffer, buffer.size()) == FAIL){
+            disconnectTCP();
+            return;
+        }
+
+        /**
+         * 5. Get answer
+         * Format: RRP status [Cursor N[ MID UID Tsize text[ / Fname 
+         * Fsize data]]*]
+         */
+        string status;
+        int res = receive_statusTCP(USER_RETRIEVE_PAGE_ANSWER, USER_HISTORY, NULL, &status, !first);
+        if (res == FAIL) return;
+        if (!res){
+            if (!first && (status != EOF_)){
+                process_status(status, "", USER_HISTORY);
+            }
+            close_session();
+            return;
+        }
+
+        char answer_cursor[MAX_MID + 3] = {'\0'};
+        char answer_N[MAX_N + 2] = {'\0'};
+        word_receiveTCP(socketTCP, answer_cursor, MAX_MID + 2);
+        word_receiveTCP(socketTCP, answer_N, MAX_N + 1);
+        N = atoi(answer_N);
+        /* The next page has to start after this one */
+        if ((strlen(answer_cursor) < MAX_MID) || !all_of_class(answer_cursor, CLASS_DIGIT) || !all_of_class(answer_N, CLASS_DIGIT) 
+            || (N < 1) || (atoi(answer_cursor) <= stoi(cursor))){
+            handle_error(SERVER, PROTOCOL);
+        }
+        cursor = string(answer_cursor);
+        first = false;
+
+        if (receive_messages(N, false, true) == FAIL){
+            return;
+        }
+    /* A page with less messages than asked is the last one */
+    } while (N == to_number(count));
+}
+
+/**
+ * tail N or tl N
+ * Following this command the User establishes a TCP session with
+ * the DS server and sends a message asking to receive the last N
+ * (up to 20) messages of the active group GID, without knowing 
+ * the MID of its last message.
+ * The reply should be displayed like the one of retrieve.
+ * 
+ * @param count the N parameter
+ */
+void User::tail(string count){
+    /* 1. Parameters verification */
+    if (!check_count(count, MAX_WINDOW, USER_TAIL)) return;
+
+    /* 2. Conditions for valid tail verification */
+    if (!check_logged_in(USER_TAIL)) return;
+    if (!check_selected(USER_TAIL)) return;
+
+    /* 3. Establish TCP connection */
+    if (open_session() == FAIL) return;
+
+    /**
+     * 4. Construct and send message
+     * Format: RTL UID GID N
      */
-    vector<string> ans = process_string(answer_head);
-    string header = ans[0];
+    char N_str[MAX_N + 1] = {'\0'};
+    sprintf(N_str, "%02u", (unsigned) to_number(count) % 100);
+    string buffer = string(USER_TAIL_REQUEST) + " " + m_uid + " " + m_gid + " " + string(N_str) + "\n";
+    if (sendTCP(socketTCP, buffer, buffer.size()) == FAIL){
+        disconnectTCP();
+        return;
+    }
 
-    if (header == ERR){
-        handle_error(SERVER, PROTOCOL);
+    /**
+     * 5. Get answer
+     * Format: RRL status [N[ MID UID Tsize text[ / Fname Fsize 
+     * data]]*]
+     */
+    int res = receive_statusTCP(USER_TAIL_ANSWER, USER_TAIL, NULL);
+    if (res == FAIL) return;
+    if (!res){
+        close_session();
+        return;
+    }
+
+    char answer_N[MAX_N + 2] = {'\0'};
+    word_receiveTCP(socketTCP, answer_N, MAX_N + 1);
+    int N = atoi(answer_N);
+    if (N == 0){
+        fprintf(stdout, "There are no messages available.\n");
+        close_session();
+        return;
+    }
+
+    receive_messages(N, false, true);
+}
+
+/**
+ * attachment MID or at MID
+ * Following this command the User establishes a TCP session with
+ * the DS server and asks for the file attached to the message 
+ * with identifier MID of the active group GID, which is saved 
+ * (e.g. after a retrieve with -m).
+ * The file is received into GID_MID.part, which is kept if the 
+ * transfer breaks: the next attachment command only asks for the
+ * bytes after the ones it already holds. It's renamed to the 
+ * file's name once complete.
+ * 
+ * @param mid the MID parameter
+ */
+void User::attachment(string mid){
+    /* 1. Parameters verification */
+    if (!check_mid(mid, USER_ATTACHMENT)) return;
+
+    /* 2. Conditions for valid attachment verification */
+    if (!check_logged_in(USER_ATTACHMENT)) return;
+    if (!check_selected(USER_ATTACHMENT)) return;
+
+    /* The bytes received by a broken transfer */
+    string partpath = m_gid + "_" + mid + ".part";
+    struct stat info;
+    long offset = (stat(partpath.c_str(), &info) == SUCCESS) ? info.st_size : 0;
+
+    /* 3. Establish TCP connection */
+    if (open_session() == FAIL) return;
+
+    /**
+     * 4. Construct and send message
+     * Format: ATR UID GID MID Offset Length (0: the rest of the file)
+     */
+    string buffer = string(USER_RANGE_REQUEST) + " " + m_uid + " " + m_gid + " " + mid + " " + to_string(offset) + " 0\n";
+    if (sendTCP(socketTCP, buffer, buffer.size()) == FAIL){
+        disconnectTCP();
+        return;
+    }
+
+    /**
+     * 5. Get answer
+     * Format: RAR status [Fname Fsize Length data]
+     */
+    string status;
+    int res = receive_statusTCP(USER_RANGE_ANSWER, USER_ATTACHMENT, NULL, &status);
+    if (res == FAIL) return;
+    if (!res){
+        /* Only a range past the end tells the partial file doesn't 
+        belong to this attachment; otherwise it's kept for later */
+        if (status == E_RANGE){
+            remove(partpath.c_str());
+            fprintf(stdout, "The partial file was discarded: try again to start over.\n");
+        }
+        close_session();
+        return;
+    }
+
+    char answer_fname[MAX_FNAME + 2] = {'\0'};
+    char answer_fsize[MAX_FSIZE + 2] = {'\0'};
+    char answer_length[MAX_FSIZE + 2] = {'\0'};
+    if (!fname_receiveTCP(socketTCP, answer_fname, USER_ATTACHMENT) 
+        || !fsize_receiveTCP(socketTCP, answer_fsize, USER_ATTACHMENT)
+        || !fsize_receiveTCP(socketTCP, answer_length, USER_ATTACHMENT)){
+        disconnectTCP();
+        return;
     }
-    if (header != USER_RETRIEVE_ANSWER){
+    long fsize = atol(answer_fsize);
+    long length = atol(answer_length);
+    if (offset + length != fsize){
         handle_error(SERVER, PROTOCOL);
     }
-    string status = ans[1];
-    if (!process_status(status, "", USER_RETRIEVE)){
-        disconnect(socketTCP);
+
+    if (receiverangeTCP(socketTCP, partpath.c_str(), offset, length) == FAIL){
+        if (stat(partpath.c_str(), &info) == SUCCESS){
+            fprintf(stdout, "Got %ld of %ld bytes of %s. Try again to resume.\n", (long) info.st_size, fsize, answer_fname);
+        }
+        disconnectTCP();
+        return;
+    }
+
+    /* Read the '\n' after the data */
+    char aux;
+    if (receiveTCP(socketTCP, &aux, 1) < 1){
+        disconnectTCP();
         return;
     }
+    if (rename(partpath.c_str(), answer_fname) == FAIL){
+        fprintf(stderr, "Unable to save %s.\n", answer_fname);
+        close_session();
+        return;
+    }
+    if (offset > 0){
+        fprintf(stdout, "Resumed at byte %ld. ", offset);
+    }
+    fprintf(stdout, "Received and saved %s (%s bytes)\n", answer_fname, answer_fsize);
+    close_session();
+}
+
+/**
+ * watch or wt
+ * Following this command the User application keeps a TCP ses-
+ * sion open with the DS server, which pushes a notification each
+ * time a message is posted to one of the groups the user is sub-
+ * scribed to. Each notification is displayed as soon as it's re-
+ * ceived, until the user presses Enter.
+ */
+void User::watch(){
+    /* 1. Conditions for valid watch verification */
+    if (!check_logged_in(USER_WATCH)) return;
+
+    /* 2. Establish TCP connection */
+    if (open_session() == FAIL) return;
 
     /**
-     * If status is OK we need to read the rest of the answer
-     * Format: [N[ MID UID Tsize text[ / Fname Fsize data]]*]
+     * 3. Construct and send message
+     * Format: WTC UID
      */
+    string buffer = string(USER_WATCH_REQUEST) + " " + m_uid + "\n";
+    if (sendTCP(socketTCP, buffer, buffer.size()) == FAIL){
+        disconnectTCP();
+        return;
+    }
 
-    /** 
-     * 5.2. Get N (0 =< N =< 20)
-     * Possible formats: "N " (N has 1 char); "N" (N has 2 chars)
+    /**
+     * 4. Get answer
+     * Format: RWT status, then GID MID for each new message
      */
-    char answer_N[MAX_N] = {'\0'};
-    if(receiveTCP(socketTCP, answer_N, MAX_N) == FAIL){
-        disconnect(socketTCP);
+    int res = receive_statusTCP(USER_WATCH_ANSWER, USER_WATCH, NULL);
+    if (res == FAIL) return;
+    if (!res){
+        disconnectTCP();
         return;
     }
+    fprintf(stdout, "Watching your groups for new messages. Press Enter to stop.\n");
 
-    int N = stoi(answer_N);
-    
-    /* If N is 0, there are no messages */
-    if (N == 0){
-        fprintf(stdout, "There are no messages available.\n");
-        disconnect(socketTCP);
+    struct pollfd fds[2];
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd = socketTCP->fd;
+    fds[1].events = POLLIN;
+
+    while (true){
+        fds[0].revents = fds[1].revents = 0;
+        if ((poll(fds, 2, -1) == FAIL) && (errno != EINTR)){
+            break;
+        }
+        if (fds[0].revents){
+            char line[MAX_INPUT_SIZE];
+            if (!fgets(line, sizeof(line)/sizeof(char), stdin)){
+                handle_error(USER, SYS_CALL);
+            }
+            break;
+        }
+        if (!fds[1].revents){
+            continue;
+        }
+
+        /* Display every notification received (and buffered) */
+        do {
+            char gid[MAX_GID + 2] = {'\0'};
+            char mid[MAX_MID + 2] = {'\0'};
+            char delimiter = '\0';
+            if (word_receiveTCP(socketTCP, gid, MAX_GID + 1, &delimiter) == 0){
+                fprintf(stderr, "The watch was closed by the server, please try again!\n");
+                disconnectTCP();
+                return;
+            }
+            /* A heartbeat: the DS checks the session is still open */
+            if ((gid[0] == '\0') && (delimiter == '\n')) continue;
+
+            word_receiveTCP(socketTCP, mid, MAX_MID + 1, &delimiter);
+            if (!parse_gid(gid) || !parse_mid(mid) || (delimiter != '\n')){
+                handle_error(SERVER, PROTOCOL);
+            }
+            fprintf(stdout, "New message in group %s: %s\n", gid, mid);
+        } while (socketTCP->rpos < socketTCP->rlen);
+    }
+
+    /* The DS ends the watch when the session is closed */
+    disconnectTCP();
+}
+
+/**
+ * inbox or ib
+ * Following this command the User application sends the DS ser-
+ * ver a message in UDP, including the user's UID, asking for the
+ * new messages posted to the groups the user is subscribed to 
+ * since the last inbox command (when the DS delivers them to in-
+ * boxes). The request acknowledges the notifications received by
+ * the last one, so the DS only removes them from the inbox then.
+ * The reply should be displayed as a list of group IDs and MIDs.
+ */
+void User::inbox(){
+    char answer[MAX_STRING_UDP] = {'\0'};
+
+    /* 1. Conditions for valid inbox verification */
+    if (!check_logged_in(USER_INBOX)) return;
+
+    /**
+     * 2. Construct and send message; get answer
+     * Format: INB UID Next
+     */
+    string next = to_string(m_inbox_next);
+    const char * fields[] = {m_uid.c_str(), next.c_str()};
+
+    if (send_requestUDP(USER_INBOX_REQUEST, fields) == FAIL){
         return;
     }
-    /* If N has 2 chars, read the space */
-    if (N >= 10){
-        char aux;
-        if(receiveTCP(socketTCP, &aux, 1) == FAIL){
-            disconnect(socketTCP);
-            return;
+    if (receive_answerUDP(answer, sizeof(answer) - 1) == FAIL){
+        return;
+    }
+
+    /**
+     * 3. Process and display result
+     * Format: RIB Next N[ GID MID]* or RIB status
+     */
+    TOKENS ans;
+    split_string(answer, &ans);
+    string_view header = ans.token[0];
+
+    if (header == ERR){
+        handle_error(SERVER, PROTOCOL);
+    }
+    if ((header != USER_INBOX_ANSWER) || (ans.n < 2)){
+        handle_error(SERVER, PROTOCOL);
+    }
+    if (!all_of_class(ans.token[1], CLASS_DIGIT)){
+        if (ans.n != 2){
+            handle_error(SERVER, PROTOCOL);
+        }
+        process_status(ans.token[1], "", USER_INBOX);
+        return;
+    }
+
+    if ((ans.n < 3) || !parse_version(ans.token[1]) || !all_of_class(ans.token[2], CLASS_DIGIT) 
+        || (ans.token[2].size() > 2)){
+        handle_error(SERVER, PROTOCOL);
+    }
+    int n = to_number(ans.token[2]);
+    if (ans.n != 2*n + 3){
+        handle_error(SERVER, PROTOCOL);
+    }
+    for (int i = 3; i < ans.n; i += 2){
+        if (!parse_gid(ans.token[i]) || !parse_mid(ans.token[i+1])){
+            handle_error(SERVER, PROTOCOL);
         }
     }
+    m_inbox_next = atol(string(ans.token[1]).c_str());
+    if (n == 0){
+        fprintf(stdout, "Your inbox is empty.\n");
+        return;
+    }
+    for (int i = 3; i < ans.n; i += 2){
+        fprintf(stdout, "New message in group %.*s: %.*s\n", (int) ans.token[i].size(), ans.token[i].data(),
+            (int) ans.token[i+1].size(), ans.token[i+1].data());
+    }
+}
+
+/**
+ * feed N or fd N
+ * Following this command the User establishes a TCP session with
+ * the DS server and sends a message asking to receive the latest
+ * N (up to 20) messages of all the groups the user is subscribed
+ * to, in the order they were posted in.
+ * The reply should be displayed like the one of retrieve, with 
+ * the group of each message.
+ * 
+ * @param count the N parameter
+ */
+void User::feed(string count){
+    /* 1. Parameters verification */
+    if (!check_count(count, MAX_FEED, USER_FEED)) return;
+
+    /* 2. Conditions for valid feed verification */
+    if (!check_logged_in(USER_FEED)) return;
+
+    /* 3. Establish TCP connection */
+    if (open_session() == FAIL) return;
+
+    /**
+     * 4. Construct and send message
+     * Format: FED UID N
+     */
+    char N_str[MAX_N + 1] = {'\0'};
+    sprintf(N_str, "%02u", (unsigned) to_number(count) % 100);
+    string buffer = string(USER_FEED_REQUEST) + " " + m_uid + " " + string(N_str) + "\n";
+    if (sendTCP(socketTCP, buffer, buffer.size()) == FAIL){
+        disconnectTCP();
+        return;
+    }
 
     /**
-     * 5.3. Get and display the N messages
-     * [ MID UID Tsize text[ / Fname Fsize data]]*
-     * Format: MID UID Tsize text[ / Fname Fsize data]]*
+     * 5. Get answer
+     * Format: RFD status [N[ GID MID UID Tsize text[ / Fname Fsize 
+     * data]]*]
      */
-    bool read_mid = false;
+    int res = receive_statusTCP(USER_FEED_ANSWER, USER_FEED, NULL);
+    if (res == FAIL) return;
+    if (!res){
+        close_session();
+        return;
+    }
+
+    char answer_N[MAX_N + 2] = {'\0'};
+    word_receiveTCP(socketTCP, answer_N, MAX_N + 1);
+    int N = atoi(answer_N);
+    if (N == 0){
+        fprintf(stdout, "There are no messages available.\n");
+        close_session();
+        return;
+    }
+
+    receive_messages(N, true, true);
+}
+
+/**
+ * Gets and displays the messages of a retrieve answer, saving the
+ * files attached to them.
+ * Format: MID UID Tsize text[ / Fname Fsize data][ MID UID Tsize
+ * text[ / Fname Fsize data]]*
+ * Each message ends with ' ' if there's another one after it, or
+ * with '\n' if it's the last one. The messages of a feed answer
+ * start with their GID. Without data (-m), attachments are only 
+ * described (" / Fname Fsize").
+ * 
+ * @param N the number of messages
+ * @param feed whether it's a feed answer
+ * @param data whether the answer carries the attachments' data
+ * @return int SUCCESS or FAIL
+ */
+int User::receive_messages(int N, bool feed, bool data){
+    bool read_next = false;
+    char answer_gid[MAX_GID + 1] = {'\0'};
     char answer_mid[MAX_MID + 1] = {'\0'};
     char answer_uid[MAX_UID + 1] = {'\0'};
     char answer_tsize[MAX_TSIZE + 1] = {'\0'};
     char answer_text[MAX_TEXT + 1] = {'\0'};
     for (int i = 0; i < N; i++){
-        /* Get MID UID Tsize text */
-        if (read_mid == false){
-            int res1 = mid_receiveTCP(socketTCP, answer_mid, USER_RETRIEVE);
-            if (res1 == FAIL) return;
-            if (!res1){
-                disconnect(socketTCP);
-                return;
+        /* Get [GID ]MID UID Tsize text */
+        if (feed && !read_next){
+            if (!gid_receiveTCP(socketTCP, answer_gid, USER_FEED)){
+                disconnectTCP();
+                return FAIL;
             }
         }
-
-        int res2 = uid_receiveTCP(socketTCP, answer_uid, USER_RETRIEVE);
-        if (res2 == FAIL) return;
-        if (!res2){
-            disconnect(socketTCP);
-            return;
+        if (feed || !read_next){
+            if (!mid_receiveTCP(socketTCP, answer_mid, USER_RETRIEVE)){
+                disconnectTCP();
+                return FAIL;
+            }
         }
 
-        int res3 = tsize_receiveTCP(socketTCP, answer_tsize, USER_RETRIEVE);
-        if (res3 == FAIL) return;
-        if (!res3){
-            disconnect(socketTCP);
-            return;
+        if (!uid_receiveTCP(socketTCP, answer_uid, USER_RETRIEVE)){
+            disconnectTCP();
+            return FAIL;
         }
 
-        int res4 = text_receiveTCP(socketTCP, answer_text, stoi(answer_tsize), USER_RETRIEVE, NULL);
-        if (res4 == FAIL) return;
-        if (!res4){
-            disconnect(socketTCP);
-            return;
+        if (!tsize_receiveTCP(socketTCP, answer_tsize, USER_RETRIEVE)){
+            disconnectTCP();
+            return FAIL;
         }
 
-        string output = "Message " + string(answer_mid) + " from user " + string(answer_uid) 
-                + ": " + string(answer_text) + " (" + string(answer_tsize) + " characters)\n";
-
-        /* Check if there is a file or not by reading the next 
-        word + 1 space */ 
-        bool hasfile = true;
-        if (i < (N - 1)){
-            char answer_nextword[MAX_MID + 1] = {'\0'};
-            memset(answer_nextword, '\0', MAX_MID + 1);
-            int k = word_receiveTCP(socketTCP, answer_nextword, MAX_MID + 1);
-            if (k == FAIL){
-                disconnect(socketTCP);
-                return;
-            }
-            answer_nextword[k] = '\0';
-
-            /* If we read a MID + 1 space there's no file */
-            if (parse_mid(string(answer_nextword))){
-                hasfile = false;
-                read_mid = true;
-                memset(answer_mid, '\0', MAX_MID + 1);
-                strcpy(answer_mid, answer_nextword);
-            }
-            /* Otherwise we read "/ " and can move on */
-            else{
-                hasfile = true;
-                read_mid = false;
-            }
+        char last_caracter = '\0';
+        int res = text_receiveTCP(socketTCP, answer_text, stoi(answer_tsize), USER_RETRIEVE, &last_caracter);
+        if (res == FAIL){
+            socketTCP = NULL;
+            return FAIL;
+        }
+        if (!res){
+            disconnectTCP();
+            return FAIL;
         }
 
-        /* If we're reading the last message, the way to see if
-        there's a file is different */
-        else{
-            /* If we've reached the end of the message, there's 
-            no file */
-            char aux;
-            int x = receiveTCP(socketTCP, &aux, 1);
-            if (x == FAIL){
-                disconnect(socketTCP);
-                return;
+        string output = "Message " + string(answer_mid) + (feed ? " of group " + string(answer_gid) : "") 
+                + " from user " + string(answer_uid) + ": " + string(answer_text) + " (" + string(answer_tsize) + " characters)\n";
+
+        /* If the text is followed by a ' ', there's either a file 
+        ("/ ") or the next message (MID or GID + 1 space) */ 
+        bool hasfile = false;
+        read_next = false;
+        if (last_caracter == ' '){
+            char answer_nextword[MAX_MID + 2] = {'\0'};
+            word_receiveTCP(socketTCP, answer_nextword, MAX_MID + 1);
+
+            if (feed ? parse_gid(answer_nextword) : parse_mid(answer_nextword)){
+                read_next = true;
+                strcpy(feed ? answer_gid : answer_mid, answer_nextword);
             }
-            if (!x){
-                hasfile = false;
+            else if (!strcmp(answer_nextword, "/")){
+                hasfile = true;
             }
-            /* Else, we've read '/'; read the ' ' and move on */
             else{
-                hasfile = true;
-                char aux_ ;
-                if (receiveTCP(socketTCP, &aux_, 1) == FAIL){
-                    disconnect(socketTCP);
-                    return;
-                }
+                disconnectTCP();
+                return FAIL;
             }
         }
+        else if (last_caracter != '\n'){
+            disconnectTCP();
+            return FAIL;
+        }
         
         /* Get Fname Fsize data (if there's a file) */
         char answer_fname[MAX_FNAME + 1] = {'\0'};
         char answer_fsize[MAX_FSIZE + 1] = {'\0'};
         if (hasfile){
-            int res5 = fname_receiveTCP(socketTCP, answer_fname, USER_RETRIEVE);
-            if (res5 == FAIL) return;
-            if (!res5){
-                disconnect(socketTCP);
-                return;
+            if (!fname_receiveTCP(socketTCP, answer_fname, USER_RETRIEVE)){
+                disconnectTCP();
+                return FAIL;
             }
-            int res6 = fsize_receiveTCP(socketTCP, answer_fsize, USER_RETRIEVE);
-            if (res6 == FAIL) return;
-            if (!res6){
-                disconnect(socketTCP);
-                return;
+            if (!fsize_receiveTCP(socketTCP, answer_fsize, USER_RETRIEVE)){
+                disconnectTCP();
+                return FAIL;
             }
             
-            int fsize = stoi(answer_fsize);
+            long fsize = atol(answer_fsize);
+            if (!data){
+                output += "Has attachment " + string(answer_fname) + " (" + string(answer_fsize) + " bytes)\n";
+                fprintf(stdout, "%s", output.c_str());
+                continue;
+            }
 
-            if (receivefileTCP(socketTCP, answer_fname, fsize) == FAIL) return;
+            if (receivefileTCP(socketTCP, answer_fname, fsize) == FAIL){
+                disconnectTCP();
+                return FAIL;
+            }
 
             output += "Also received and saved " + string(answer_fname) + " (" + string(answer_fsize) + " bytes)\n";
 
             /* Read extra ' ' or '\n' after the data */
             char aux;
-            if(receiveTCP(socketTCP, &aux, 1) == FAIL){
-                disconnect(socketTCP);
-                return;
+            if(receiveTCP(socketTCP, &aux, 1) < 1){
+                disconnectTCP();
+                return FAIL;
             }            
         }  
         
         fprintf(stdout, "%s", output.c_str());
     }
 
-    disconnect(socketTCP);
+    close_session();
+    return SUCCESS;
 }
 
 //::::::::::::::::::::::::::: MAIN :::::::::::::::::::::::::::://
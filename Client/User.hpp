@@ -11,6 +11,8 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <poll.h>
+#include <signal.h>
 #include <string.h>
 #include <cstring>
 #include <string>
@@ -25,15 +27,41 @@ using namespace checkers;
 using namespace protocols;
 using namespace auxiliaries;
 
+/* The groups of the last listing, kept up to date by delta listings */
+typedef struct groupcache {
+    long version; /* The catalog version of the listing (0: none yet) */
+    char group_name[MAX_NGROUPS][MAX_GNAME + 1]; /* The GName of each group, "" if it isn't listed */
+    char group_mid[MAX_NGROUPS][MAX_MID + 1]; /* The MID of the last message of each group */
+} GROUPCACHE;
+
+/* An upload which was left unfinished by a broken post (-u) */
+typedef struct upload {
+    string id; /* The ID of the upload, "" if there's none */
+    string gid, text, fname; /* The message being posted */
+    long fsize; /* The size of its file */
+} UPLOAD;
+
 class User {
     string m_dsip, m_dsport;
 
     SOCKET * socketUDP, * socketTCP;
+    struct addrinfo * m_tcp_res; /* Cached TCP address of the DS */
 
     string m_uid;
     string m_pass;
     string m_gid;
 
+    bool m_keepalive; /* Keep a persistent TCP session with the DS (-k) */
+    bool m_framed; /* Send TCP requests with the binary framing (-2) */
+    bool m_meta; /* Retrieve without the attachments' data (-m) */
+    bool m_chunked; /* Post files in chunks, through an upload (-u) */
+
+    UPLOAD m_upload; /* The upload to resume */
+    long m_inbox_next; /* The sequence number after the last notification received (inbox) */
+
+    GROUPCACHE m_groups; /* The last groups listing */
+    GROUPCACHE m_my_groups; /* The last my_groups listing */
+
 public:
     User(int argc, char** argv);
 
@@ -45,8 +73,19 @@ private:
 
     //::::::::::::::::::::: COMMUNICATION ::::::::::::::::::::://
     void connectUDP(string ip, string port);
-    void connectTCP(string ip, string port);
-    bool process_status(string status, string extra, string command);
+    void resolveTCP(string ip, string port);
+    int connectTCP(string ip, string port);
+    bool session_alive();
+    int open_session();
+    void close_session();
+    void disconnectTCP();
+    int send_requestUDP(const char * request, const char * const * fields);
+    int receive_answerUDP(char * answer, int size);
+    bool busy(const char * answer);
+    int send_frame(int opcode, string payload, long extra, int flags = 0);
+    int receive_statusTCP(string answer, string command, char * last_caracter, string * status_out = NULL, bool quiet = false);
+    long receive_countTCP(string answer);
+    bool process_status(string_view status, string_view extra, string_view command);
 
     //::::::::::::::::::::::: CHECKERS :::::::::::::::::::::::://
     bool check_logged_in(string command);
@@ -54,7 +93,8 @@ private:
     bool check_not_logged_in(string command);
     
     //::::::::::::::::::::::: PRINTERS :::::::::::::::::::::::://
-    void print_groups(vector<string> ans);
+    int merge_groups(TOKENS * ans, int offset, GROUPCACHE * cache);
+    void print_groups(GROUPCACHE * cache);
 
     //::::::::::::::::::::::: COMMANDS :::::::::::::::::::::::://
     void reg(string uid, string pass);
@@ -67,11 +107,23 @@ private:
     void subscribe(string gid, string gname);
     void unsubscribe(string gid);
     void my_groups();
+    void list_groups(const char * request, const char * answer, const char * uid, GROUPCACHE * cache);
     void usr_select(string gid);
     void showgid();
     void ulist();
     void post(string text, string fname, int nparams);
+    void upload(string text, string fname);
+    void upload_chunks(string text, string fname);
     void retrieve(string mid);
+    void history(string count);
+    void tail(string count);
+    void attachment(string mid);
+    void watch();
+    void inbox();
+    void feed(string count);
+
+    //::::::::::::::::::::::: RECEIVERS ::::::::::::::::::::::://
+    int receive_messages(int N, bool feed, bool data);
 
 };
 
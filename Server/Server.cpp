@@ -4,9 +4,22 @@
 Server::Server(int argc, char** argv){
 
     m_verbose = false;
+    m_nworkers = 0;
+    m_sessions = 0;
+    m_shed_udp = 0;
+    m_shed_tcp_rate = 0;
+    m_shed_tcp_full = 0;
+    m_persistent = false;
+    m_keep = false;
+    m_framed = false;
+    m_fanout = false;
+    m_catalog = (GROUPLIST *) malloc(sizeof(GROUPLIST));
+    m_catalog_version = -1;
 
     parse_arguments(argc, argv);
 
+    stamp_groups();
+
     initialize_connection();
 
     receive_request();
@@ -23,7 +36,7 @@ Server::Server(int argc, char** argv){
  * ges, and the other in TCP, to answer messaging requests, both
  * originating in the User application.
  * 
- * Usage: ./DS [-p DSport] [-v]
+ * Usage: ./DS [-p DSport] [-v] [-w workers] [-b bandwidth] [-f]
  * . DSport is the well-known port where DS accepts requests. If 
  * it's ommited then it assumes the value 58000+GN where GN is 
  * the group number (12).
@@ -31,6 +44,16 @@ Server::Server(int argc, char** argv){
  * tes in verbose mode, meaning that the DS server outputs to the 
  * screen a short description of the received requests (UID, GID)
  * and the IP and port originating those requests
+ * . if the -w option is set, the DS pre-forks that many TCP wor-
+ * kers instead of forking once per connection. Every idle worker
+ * waits in accept on the shared listening socket, so whichever
+ * worker is free takes the next session and a heavy RTV never
+ * holds back the others.
+ * . if the -b option is set, each attachment transfer is limited
+ * to that many bytes per second.
+ * . if the -f option is set, each new message is also delivered 
+ * to the inbox of every subscriber of its group (fan-out on wri-
+ * te), so a user gets the news of all its groups at once (INB).
  * 
  * @param argc number of arguments
  * @param argv vector of arguments
@@ -40,7 +63,7 @@ void Server::parse_arguments(int argc, char** argv){
     int max_argc = 1;
 
     char c;
-    while((c = getopt(argc, argv, "p:v")) != -1) {
+    while((c = getopt(argc, argv, "p:vw:b:f")) != -1) {
         switch(c) {
             case 'p':
                 m_dsport = optarg;
@@ -50,8 +73,30 @@ void Server::parse_arguments(int argc, char** argv){
                 m_verbose = true;
                 max_argc += 1;
                 break;
+            case 'w':
+                m_nworkers = atoi(optarg);
+                max_argc += 2;
+                break;
+            case 'b':{
+                /* The cap can't be below the rate under which a 
+                transfer is given up on (see too_slow) */
+                errno = 0;
+                long bandwidth = strtol(optarg, NULL, 10);
+                if (!all_of_class(optarg, CLASS_DIGIT) || (errno == ERANGE) || (bandwidth < MIN_TRANSFER_RATE)){
+                    fprintf(stderr, "Usage: %s [-p DSport] [-v] [-w workers] [-b bandwidth] [-f]\n", argv[0]);
+                    fprintf(stderr, "The bandwidth is a number of bytes per second, at least %d.\n", MIN_TRANSFER_RATE);
+                    exit(EXIT_FAILURE);
+                }
+                set_bandwidth(bandwidth);
+                max_argc += 2;
+                break;
+            }
+            case 'f':
+                m_fanout = true;
+                max_argc += 1;
+                break;
             default:
-                fprintf(stderr, "Usage: %s [-p DSport] [-v]\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-p DSport] [-v] [-w workers] [-b bandwidth] [-f]\n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
@@ -59,98 +104,130 @@ void Server::parse_arguments(int argc, char** argv){
     if(m_dsport.empty())
         m_dsport = DSPORT_DEFAULT;
 
-    if(max_argc < argc) {
-        fprintf(stderr, "Usage: %s [-p DSport] [-v]\n", argv[0]);
+    if((max_argc < argc) || (m_nworkers < 0) || (m_nworkers > MAX_WORKERS)) {
+        fprintf(stderr, "Usage: %s [-p DSport] [-v] [-w workers] [-b bandwidth] [-f]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 }
 
 /**
- * Reads each request and parses it in order to execute the cor-
- * responding command.
+ * Reads each UDP request and parses it in order to execute the 
+ * corresponding command.
  */
 void Server::handle_request(char * request){
-    char command[MAX_INPUT_SIZE] = {'\0'};
-    char arg1[MAX_INPUT_SIZE] = {'\0'};
-    char arg2[MAX_INPUT_SIZE] = {'\0'};
-    char arg3[MAX_INPUT_SIZE] = {'\0'};
-
-    int numTokens = sscanf(request, "%s %s %s %s", command, arg1, arg2, arg3);
-
-    string arg1_str = string(arg1);
-    string arg2_str = string(arg2);
-    string arg3_str = string(arg3);
-
-    bool err = false;
-
-    if (!strcmp(command, USER_REG_REQUEST)){
-        if (!parse_nparam(numTokens, 3)){
-err = true;            err = true;
-        }
-        reg(arg1_str, arg2_str);
-    }
-    else if (!strcmp(command, USER_UNREGISTER_REQUEST)){
-        if (!parse_nparam(numTokens, 3)){
-            err = true;
-        }
-        unregister(arg1_str, arg2_str);
-    }
-    else if (!strcmp(command, USER_LOGIN_REQUEST)){
-        if (!parse_nparam(numTokens, 3)){
-            err = true;
-        }
-        login(arg1_str, arg2_str);
-    }
-    else if (!strcmp(command, USER_LOGOUT_REQUEST)){
-        if (!parse_nparam(numTokens, 3)){
-            err = true;
-        }
-        logout(arg1_str, arg2_str);
-    }
-    else if (!strcmp(command, USER_GROUPS_REQUEST)){
-        if (!parse_nparam(numTokens, 1)){
-            err = true;
-        }
-        groups();
-    }
-    else if (!strcmp(command, USER_SUBSCRIBE_REQUEST)){
-        if (!parse_nparam(numTokens, 4)){
-            err = true;
-        }
-        subscribe(arg1, arg2, arg3);
-    }
-    else if (!strcmp(command, USER_UNSUBSCRIBE_REQUEST)){
-        if (!parse_nparam(numTokens, 3)){
-            err = true;
+    /* UDP requests are parsed and validated by their schema */
+    if (find_schema(request) != NULL){
+        const SCHEMA * schema;
+        char fields[MAX_FIELDS][MAX_FIELD + 1] = {{'\0'}};
+
+        int valid = parse_request(request, &schema, fields);
+        if (valid == FAIL){
+            sendstatusUDP(socketUDP, "", ERR);
+            return;
         }
-        unsubscribe(arg1, arg2);
-    }
-    else if (!strcmp(command, USER_MY_GROUPS_REQUEST)){
-        if (!parse_nparam(numTokens, 2)){
-            err = true;
+        if (valid < schema->nfields){
+            sendstatusUDP(socketUDP, schema->answer, schema->fields[valid].invalid);
+            return;
         }
-        my_groups(arg1);
-    }
 
-    /* Remember that for the TCP commands we have only received
-    the first 4 bytes of the message, which indicate which com-
-    mand to execute */
-    else if (!strcmp(command, USER_ULIST_REQUEST)){
-        ulist();
-    }
-    else if (!strcmp(command, USER_POST_REQUEST)){
-        post();
-    }
-    else if (!strcmp(command, USER_RETRIEVE_REQUEST)){
-        retrieve();
+        switch(pack_opcode(schema->request)){
+            case pack_opcode(USER_REG_REQUEST):
+                reg(fields[0], fields[1]);
+                break;
+            case pack_opcode(USER_UNREGISTER_REQUEST):
+                unregister(fields[0], fields[1]);
+                break;
+            case pack_opcode(USER_LOGIN_REQUEST):
+                login(fields[0], fields[1]);
+                break;
+            case pack_opcode(USER_LOGOUT_REQUEST):
+                logout(fields[0], fields[1]);
+                break;
+            case pack_opcode(USER_GROUPS_REQUEST):
+                groups(USER_GROUPS_ANSWER, false, 0, 1, MAX_NGROUPS);
+                break;
+            case pack_opcode(USER_GROUPS_PAGE_REQUEST):
+                groups(USER_GROUPS_PAGE_ANSWER, false, 0, atoi(fields[0]), atoi(fields[1]));
+                break;
+            case pack_opcode(USER_GROUPS_DELTA_REQUEST):
+                groups(USER_GROUPS_DELTA_ANSWER, true, atol(fields[0]), atoi(fields[1]), atoi(fields[2]));
+                break;
+            case pack_opcode(USER_SUBSCRIBE_REQUEST):
+                subscribe(fields[0], fields[1], fields[2]);
+                break;
+            case pack_opcode(USER_UNSUBSCRIBE_REQUEST):
+                unsubscribe(fields[0], fields[1]);
+                break;
+            case pack_opcode(USER_MY_GROUPS_REQUEST):
+                my_groups(fields[0], USER_MY_GROUPS_ANSWER, false, 0, 1, MAX_NGROUPS);
+                break;
+            case pack_opcode(USER_MY_GROUPS_PAGE_REQUEST):
+                my_groups(fields[0], USER_MY_GROUPS_PAGE_ANSWER, false, 0, atoi(fields[1]), atoi(fields[2]));
+                break;
+            case pack_opcode(USER_MY_GROUPS_DELTA_REQUEST):
+                my_groups(fields[0], USER_MY_GROUPS_DELTA_ANSWER, true, atol(fields[1]), atoi(fields[2]), atoi(fields[3]));
+                break;
+            case pack_opcode(USER_INBOX_REQUEST):
+                inbox(fields[0], atol(fields[1]));
+                break;
+        }
+        return;
     }
 
-    else{
-        sendstatusUDP(socketUDP, "", ERR);
-    }
+    /* TCP commands are never served over UDP, as there is no TCP
+    session to answer them in */
+    sendstatusUDP(socketUDP, "", ERR);
+}
 
-    if (err == true){
-        sendstatusUDP(socketUDP, "", ERR);
+/**
+ * Executes the command of a TCP request. Remember that for the TCP
+ * commands we have only received the first 4 bytes of the message,
+ * which indicate which command to execute.
+ * 
+ * @param request the first bytes of the request
+ */
+void Server::handle_tcp_request(char * request){
+    switch(pack_opcode(request)){
+        case pack_opcode(USER_ULIST_REQUEST):
+            ulist();
+            break;
+        case pack_opcode(USER_POST_REQUEST):
+            post();
+            break;
+        case pack_opcode(USER_RETRIEVE_REQUEST):
+            retrieve(true);
+            break;
+        case pack_opcode(USER_RETRIEVE_META_REQUEST):
+            retrieve(false);
+            break;
+        case pack_opcode(USER_ATTACHMENT_REQUEST):
+            attachment(false);
+            break;
+        case pack_opcode(USER_RANGE_REQUEST):
+            attachment(true);
+            break;
+        case pack_opcode(USER_UPLOAD_OPEN_REQUEST):
+            upload_open();
+            break;
+        case pack_opcode(USER_UPLOAD_CHUNK_REQUEST):
+            upload_chunk();
+            break;
+        case pack_opcode(USER_UPLOAD_QUERY_REQUEST):
+        case pack_opcode(USER_UPLOAD_COMMIT_REQUEST):
+            upload_finish(pack_opcode(request) == pack_opcode(USER_UPLOAD_COMMIT_REQUEST));
+            break;
+        case pack_opcode(USER_WATCH_REQUEST):
+            watch();
+            break;
+        case pack_opcode(USER_FEED_REQUEST):
+            feed();
+            break;
+        case pack_opcode(USER_RETRIEVE_PAGE_REQUEST):
+            retrieve_page();
+            break;
+        case pack_opcode(USER_TAIL_REQUEST):
+            tail();
+            break;
     }
 }
 
@@ -161,6 +238,7 @@ err = true;            err = true;
  * this function only for good practice reasons.
  */
 void Server::terminate(){
+    free(m_catalog);
     disconnect(socketUDP);
     disconnect(socketTCP);
     exit(EXIT_SUCCESS);
@@ -215,6 +293,9 @@ void Server::connectUDP(string port){
     strcpy(socketUDP->owner, SERVER);
     socketUDP->fd = fd;
     socketUDP->res = res;
+    socketUDP->rpos = 0;
+    socketUDP->rlen = 0;
+    socketUDP->deadline = 0;
 }
 
 /**
@@ -245,7 +326,7 @@ void Server::connectTCP(string port){
         exit(EXIT_FAILURE);
     }
 
-    if(listen(fd, 10) == FAIL){
+    if(listen(fd, LISTEN_BACKLOG) == FAIL){
         fprintf(stderr, "Unable to listen.\n");
         exit(EXIT_FAILURE);
     }
@@ -254,81 +335,602 @@ void Server::connectTCP(string port){
     strcpy(socketTCP->owner, SERVER);
     socketTCP->fd = fd;
     socketTCP->addr = servaddr;
+    socketTCP->rpos = 0;
+    socketTCP->rlen = 0;
+    socketTCP->deadline = 0;
+}
+
+/**
+ * Wakes the DS up (interrupting select/accept) whenever a child
+ * process terminates, so that it can be reaped.
+ * 
+ * @param signo the received signal (SIGCHLD)
+ */
+void sig_chld(int signo){
+    (void) signo;
+}
+
+/* Set when the DS is asked (SIGUSR1) to print its statistics */
+static volatile sig_atomic_t stats_requested = 0;
+
+/**
+ * Asks the DS to print its statistics (namely the load it shed),
+ * as soon as it is back in the main loop.
+ * Usage: kill -USR1 <DS pid>
+ * 
+ * @param signo the received signal (SIGUSR1)
+ */
+void sig_usr1(int signo){
+    (void) signo;
+    stats_requested = 1;
 }
 
 /**
  * Always-running function which allows the server to wait cons-
  * tantly for requests from users and respond to them.
- * Each received request is processed once it's received.
- * Only one request is processed at a time. (change this by using
- * fork?)
+ * UDP requests are processed by the DS itself, once they're re-
+ * ceived. Each TCP session is either handed to a new child pro-
+ * cess (fork per connection) or, if the DS runs with a worker 
+ * pool, accepted directly by the first idle worker.
  */
 void Server::receive_request(){
     /* source: https://www.geeksforgeeks.org/tcp-and-udp-server-using-select/ */
-    int tcpfd, connfd, udpfd, maxfdp1;
-    char bufferUDP[MAX_REQUEST_UDP], bufferTCP[MAX_HEAD_TCP];
+    int tcpfd, udpfd, maxfdp1;
     fd_set rset;
-    ssize_t n;
-    socklen_t len;
-    struct sockaddr_in cliaddr;
     void sig_chld(int);
-    pid_t childpid;
+    void sig_usr1(int);
 
     tcpfd = socketTCP->fd;
     udpfd = socketUDP->fd;
 
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = sig_chld;
+    sigemptyset(&act.sa_mask);
+    if (sigaction(SIGCHLD, &act, NULL) == FAIL){
+        handle_error(SERVER, SYS_CALL);
+    }
+    act.sa_handler = sig_usr1;
+    if (sigaction(SIGUSR1, &act, NULL) == FAIL){
+        handle_error(SERVER, SYS_CALL);
+    }
+    /* A user gone mid-answer must only fail that write */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* The workers block in accept; otherwise only the DS accepts,
+    after select, and it must never block there */
+    if (m_nworkers == 0){
+        fcntl(tcpfd, F_SETFL, fcntl(tcpfd, F_GETFL) | O_NONBLOCK);
+    }
+    for (int i = 0; i < m_nworkers; i++){
+        m_workers.push_back(spawn_worker());
+    }
+
     FD_ZERO(&rset);
 
     maxfdp1 = max(tcpfd, udpfd) + 1;
     while(true){
-        FD_SET(tcpfd, &rset);
+        /* The workers (if any) accept the TCP sessions themselves */
+        if (m_nworkers == 0){
+            FD_SET(tcpfd, &rset);
+        }
         FD_SET(udpfd, &rset);
 
-        select(maxfdp1, &rset, NULL, NULL, NULL);
+        int ready = select(maxfdp1, &rset, NULL, NULL, NULL);
+        if ((ready == FAIL) && (errno != EINTR)){
+            handle_error(SERVER, SYS_CALL);
+        }
+
+        reap_children();
+        if (stats_requested){
+            stats_requested = 0;
+            print_stats();
+        }
+        /* Interrupted by a signal */
+        if (ready == FAIL) continue;
         
-        /* TCP request */
+        /* TCP requests */
         if (FD_ISSET(tcpfd, &rset)){
-            len = sizeof(cliaddr);
-            connfd = accept(tcpfd, (struct sockaddr*)&cliaddr, &len);
-            if (connfd == FAIL){
-                handle_error(SERVER, SYS_CALL);
-            }
-            if ((childpid = fork()) == 0){
-                close(socketTCP->fd);
-                /* For TCP messages, we will only read the first 4 
-                bytes, which indicate the command to be executed.
-                The rest of each message will be read separately.
-                */
-                bzero(bufferTCP, MAX_HEAD_TCP);
-                
-                sTCP = (SOCKET *) malloc(sizeof(SOCKET));
-                sTCP->fd = connfd;
-                strcpy(sTCP->owner, SERVER);
-                n = receiveTCP(sTCP, bufferTCP, MAX_HEAD_TCP);
+            accept_connections();
+        }
+        
+        /* UDP requests */
+        if (FD_ISSET(udpfd, &rset)){
+            serve_datagrams();
+        }
+    }
+}
 
-                if (n == FAIL){
-                    handle_error(SERVER, SYS_CALL);
-                }
-                
-                handle_request(bufferTCP);
+/**
+ * Accepts every TCP connection waiting in the listening queue (up
+ * to MAX_ACCEPT_BATCH), handing each one to a new child process.
+ * Draining the queue in a single wakeup, instead of accepting one
+ * connection per select, keeps the DS from becoming the bottleneck
+ * when many short ULS/PST/RTV sessions arrive at once.
+ */
+void Server::accept_connections(){
+    struct sockaddr_in cliaddr;
+    socklen_t len;
+    pid_t childpid;
 
-                exit(0);
-            }
-            close(connfd);
+    for (int i = 0; i < MAX_ACCEPT_BATCH; i++){
+        len = sizeof(cliaddr);
+        int connfd = accept(socketTCP->fd, (struct sockaddr*)&cliaddr, &len);
+        if (connfd == FAIL){
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+            if ((errno == EINTR) || (errno == ECONNABORTED)) continue;
+            handle_error(SERVER, SYS_CALL);
+        }
+        /* Some systems pass the listening socket's O_NONBLOCK on to
+        the accepted one, but the sessions use blocking I/O */
+        fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL) & ~O_NONBLOCK);
+
+        /* Admission control: shed the session right away if there
+        are too many open, or if this client is over its budget */
+        if (m_sessions >= MAX_SESSIONS){
+            m_shed_tcp_full++;
+            reject_connection(connfd);
+            continue;
+        }
+        if (!admit(m_tcp_buckets, cliaddr.sin_addr.s_addr, TCP_RATE, TCP_BURST)){
+            m_shed_tcp_rate++;
+            reject_connection(connfd);
+            continue;
+        }
+
+        if ((childpid = fork()) == 0){
+            close(socketTCP->fd);
+            handle_connection(connfd, cliaddr);
+            exit(0);
+        }
+        if (childpid != FAIL){
+            m_sessions++;
+        }
+        close(connfd);
+    }
+}
+
+/**
+ * Answers every UDP request already waiting in the socket (up to
+ * MAX_UDP_BATCH) before going back to select.
+ */
+void Server::serve_datagrams(){
+    char bufferUDP[MAX_REQUEST_UDP + 2];
+
+    for (int i = 0; i < MAX_UDP_BATCH; i++){
+        if ((i > 0) && !pending(socketUDP->fd)) return;
+
+        /* One byte more than a request may take is received, so a 
+        longer datagram is told apart from one that fits */
+        bzero(bufferUDP, MAX_REQUEST_UDP + 2);
+        int n = receiveUDP(socketUDP, bufferUDP, MAX_REQUEST_UDP + 1);
+        if (n == FAIL){
+            handle_error(SERVER, SYS_CALL);
+        }
+        if (n > MAX_REQUEST_UDP){
+            sendstatusUDP(socketUDP, "", ERR);
+            continue;
+        }
+
+        /* Admission control: the client is over its budget */
+        if (!admit(m_udp_buckets, (socketUDP->addr).sin_addr.s_addr, UDP_RATE, UDP_BURST)){
+            m_shed_udp++;
+            sendstatusUDP(socketUDP, "", BUSY);
+            continue;
         }
         
-        /* UDP request */
-        if (FD_ISSET(udpfd, &rset)){
-            bzero(bufferUDP, MAX_REQUEST_UDP);
-            
-            n = receiveUDP(socketUDP, bufferUDP);
-            if (n == FAIL){
-                handle_error(SERVER, SYS_CALL);
+        handle_request(bufferUDP);
+    }
+}
+
+/**
+ * Indicates if there's something to be read from a file descrip-
+ * tor, without blocking.
+ * 
+ * @param fd the file descriptor
+ * @return true if a read wouldn't block
+ * @return false if it would
+ */
+bool Server::pending(int fd){
+    fd_set rfds;
+    struct timeval tv = {0, 0};
+
+    FD_ZERO(&rfds);
+    FD_SET(fd, &rfds);
+    return select(fd + 1, &rfds, NULL, NULL, &tv) > 0;
+}
+
+/**
+ * Serves one TCP session, given by the accepted connection.
+ * Usually a session carries a single request. If the client opens
+ * it with SES, it becomes a persistent session: the client may 
+ * then send (and pipeline) any number of requests, which are ans-
+ * wered in order, until it closes the connection.
+ * 
+ * @param connfd the file descriptor of the accepted connection
+ * @param cliaddr the address of the client
+ */
+void Server::handle_connection(int connfd, struct sockaddr_in cliaddr){
+    sTCP = (SOCKET *) malloc(sizeof(SOCKET));
+    sTCP->fd = connfd;
+    sTCP->addr = cliaddr;
+    sTCP->rpos = 0;
+    sTCP->rlen = 0;
+    sTCP->deadline = 0;
+    strcpy(sTCP->owner, SERVER);
+    set_deadlines(sTCP, SESSION_TIMEOUT);
+    set_lane(sTCP, LANE_LATENCY);
+
+    m_persistent = false;
+    while (serve_tcp_request());
+}
+
+/**
+ * Reads and executes the next request of a TCP session. For TCP 
+ * messages, we will only read the first 4 bytes, which indicate 
+ * the command to be executed. The rest of each message will be 
+ * read separately.
+ * 
+ * @return true if the session remains open for more requests
+ * @return false if the session is over (and sTCP was disconnected)
+ */
+bool Server::serve_tcp_request(){
+    char bufferTCP[FRAME_HEADER + 1] = {'\0'};
+
+    /* The client closed the session (or let it idle for too long) */
+    sTCP->deadline = 0;
+    if (receiveTCP(sTCP, bufferTCP, 1) < 1){
+        disconnect(sTCP);
+        return false;
+    }
+    /* The rest of the request must arrive in time, however slowly
+    it trickles in */
+    sTCP->deadline = time(NULL) + REQUEST_TIMEOUT;
+
+    /* The first byte tells a framed (v2) request from a text one */
+    m_framed = ((unsigned char) bufferTCP[0] == FRAME_MAGIC);
+    if (m_framed){
+        if (receiveTCP(sTCP, bufferTCP + 1, FRAME_HEADER - 1) < FRAME_HEADER - 1){
+            disconnect(sTCP);
+            return false;
+        }
+        m_keep = false;
+        serve_frame((unsigned char *) bufferTCP);
+        return m_keep;
+    }
+
+    if (receiveTCP(sTCP, bufferTCP + 1, MAX_HEAD_TCP - 1) < MAX_HEAD_TCP - 1){
+        disconnect(sTCP);
+        return false;
+    }
+
+    switch(pack_opcode(bufferTCP)){
+        /* Format: SES; answer: RSE OK */
+        case pack_opcode(USER_SESSION_REQUEST):
+            if (bufferTCP[3] != '\n') break;
+            m_persistent = true;
+            if (sendstatusTCP(sTCP, USER_SESSION_ANSWER, OK) == FAIL){
+                disconnect(sTCP);
+                return false;
+            }
+            return true;
+
+        case pack_opcode(USER_ULIST_REQUEST):
+        case pack_opcode(USER_POST_REQUEST):
+        case pack_opcode(USER_RETRIEVE_REQUEST):
+        case pack_opcode(USER_RETRIEVE_META_REQUEST):
+        case pack_opcode(USER_ATTACHMENT_REQUEST):
+        case pack_opcode(USER_RANGE_REQUEST):
+        case pack_opcode(USER_UPLOAD_OPEN_REQUEST):
+        case pack_opcode(USER_UPLOAD_CHUNK_REQUEST):
+        case pack_opcode(USER_UPLOAD_QUERY_REQUEST):
+        case pack_opcode(USER_UPLOAD_COMMIT_REQUEST):
+        case pack_opcode(USER_WATCH_REQUEST):
+        case pack_opcode(USER_FEED_REQUEST):
+        case pack_opcode(USER_RETRIEVE_PAGE_REQUEST):
+        case pack_opcode(USER_TAIL_REQUEST):
+            m_keep = false;
+            handle_tcp_request(bufferTCP);
+            return m_keep;
+    }
+
+    /* Only ULS, PST, UPO, UPC, UPQ, UPF, RTV, RTM, RTP, RTL, ATT, 
+    ATR, WTC and FED are TCP commands; anything else is 
+    answered here, so the connection is never left open */
+    sendstatusTCP(sTCP, "", ERR);
+    disconnect(sTCP);
+    return false;
+}
+
+/**
+ * Serves a framed (v2) request, whose header was already received.
+ * The fixed-width fields of the payload are received at once and 
+ * checked against the payload length, so no delimiter has to be
+ * searched for. The answer is the same as for a text request.
+ * 
+ * @param header the FRAME_HEADER bytes of the header
+ */
+void Server::serve_frame(unsigned char * header){
+    int opcode, flags;
+    uint32_t length;
+    unsigned char payload[FRAME_POST_SIZE + MAX_TEXT] = {0};
+
+    /* Only requests of a known size are read */
+    uint32_t size = 0;
+    if (unpack_frame(header, &opcode, &flags, &length) == SUCCESS){
+        switch(opcode){
+            case FRAME_ULIST:
+                size = FRAME_ULIST_SIZE;
+                break;
+            case FRAME_POST:
+                size = FRAME_POST_SIZE;
+                break;
+            case FRAME_RETRIEVE:
+                size = FRAME_RETRIEVE_SIZE;
+                break;
+        }
+    }
+    if ((size == 0) || (length < size) || ((opcode != FRAME_POST) && (length != size))){
+        sendstatusTCP(sTCP, "", ERR);
+        disconnect(sTCP);
+        return;
+    }
+    if ((int) receiveTCP(sTCP, (char *) payload, size) < (int) size){
+        disconnect(sTCP);
+        return;
+    }
+    if (flags & FRAME_KEEP){
+        m_persistent = true;
+    }
+
+    char uid[MAX_UID + 1] = {'\0'};
+    char gid[MAX_GID + 1] = {'\0'};
+    char mid[MAX_MID + 1] = {'\0'};
+    switch(opcode){
+        /* Format: GID */
+        case FRAME_ULIST:
+            get_field(gid, payload, MAX_GID);
+            if (!parse_gid(gid)){
+                sendstatusTCP(sTCP, USER_ULIST_ANSWER, NOK);
+                disconnect(sTCP);
+                return;
+            }
+            ulist_execute(gid);
+            return;
+
+        /* Format: UID GID MID */
+        case FRAME_RETRIEVE:
+            get_field(uid, payload, MAX_UID);
+            get_field(gid, payload + MAX_UID, MAX_GID);
+            get_field(mid, payload + MAX_UID + MAX_GID, MAX_MID);
+            if (!parse_uid(uid) || !parse_gid(gid) || !parse_mid(mid)){
+                sendstatusTCP(sTCP, (flags & FRAME_META) ? USER_RETRIEVE_META_ANSWER : USER_RETRIEVE_ANSWER, NOK);
+                disconnect(sTCP);
+                return;
             }
-            
-            handle_request(bufferUDP);
+            retrieve_execute(uid, gid, mid, !(flags & FRAME_META));
+            return;
+    }
+
+    /* Format: UID GID Tsize Fname Fsize text data */
+    char fname[MAX_FNAME + 1] = {'\0'};
+    char text[MAX_TEXT + 1] = {'\0'};
+    get_field(uid, payload, MAX_UID);
+    get_field(gid, payload + MAX_UID, MAX_GID);
+    uint32_t tsize = get_uint(payload + MAX_UID + MAX_GID, 2);
+    get_field(fname, payload + MAX_UID + MAX_GID + 2, MAX_FNAME);
+    uint32_t fsize = get_uint(payload + MAX_UID + MAX_GID + 2 + MAX_FNAME, 4);
+
+    /* The sum is done in 64 bits, so a huge Fsize can't wrap it 
+    around to the payload length */
+    bool valid = parse_uid(uid) && parse_gid(gid) && (tsize <= MAX_TEXT)
+        && ((uint64_t) length == (uint64_t) size + tsize + fsize);
+    if (fname[0] == '\0'){
+        valid = valid && (fsize == 0);
+    }
+    else{
+        valid = valid && parse_fname(fname) && parse_fsize(to_string(fsize));
+    }
+    if (!valid){
+        sendstatusTCP(sTCP, USER_POST_ANSWER, NOK);
+        disconnect(sTCP);
+        return;
+    }
+
+    if ((uint32_t) receiveTCP(sTCP, text, tsize) < tsize){
+        disconnect(sTCP);
+        return;
+    }
+    text[tsize] = '\0';
+    if (!check_text(text, USER_POST)){
+        sendstatusTCP(sTCP, USER_POST_ANSWER, NOK);
+        disconnect(sTCP);
+        return;
+    }
+
+    post_execute(uid, gid, text, fname, fsize);
+}
+
+/**
+ * Ends a TCP request whose answer was completely sent. The con-
+ * nection is closed, unless the session is persistent, in which
+ * case it stays open for the next request. Requests which can't
+ * be fully read (or answered) always close the connection instead,
+ * as the rest of the stream can no longer be trusted.
+ */
+void Server::finish_request(){
+    if (m_persistent){
+        m_keep = true;
+        return;
+    }
+    disconnect(sTCP);
+}
+
+//:::::::::::::::::::::::: WORKER POOL :::::::::::::::::::::::://
+/**
+ * Creates a new TCP worker process.
+ * 
+ * @return pid_t the PID of the new worker
+ */
+pid_t Server::spawn_worker(){
+    pid_t pid = fork();
+    if (pid == FAIL){
+        handle_error(SERVER, SYS_CALL);
+    }
+    if (pid == 0){
+        run_worker();
+        exit(EXIT_SUCCESS);
+    }
+    return pid;
+}
+
+/**
+ * Main loop of a TCP worker. Every idle worker blocks in accept
+ * on the shared listening socket and the kernel hands each new 
+ * connection to one of them, so sessions always go to a worker 
+ * that is free, no matter how long the others take.
+ */
+void Server::run_worker(){
+    struct sockaddr_in cliaddr;
+    socklen_t len;
+
+    while (true){
+        len = sizeof(cliaddr);
+        int connfd = accept(socketTCP->fd, (struct sockaddr*)&cliaddr, &len);
+        if (connfd == FAIL){
+            if ((errno == EINTR) || (errno == ECONNABORTED)) continue;
+            handle_error(SERVER, SYS_CALL);
+        }
+        handle_connection(connfd, cliaddr);
+    }
+}
+
+/**
+ * Collects every terminated child process. If it was one of the
+ * TCP workers, a new one takes its place, so the pool always has
+ * the same size.
+ */
+void Server::reap_children(){
+    pid_t pid;
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0){
+        vector<pid_t>::iterator it = find(m_workers.begin(), m_workers.end(), pid);
+        if (it != m_workers.end()){
+            *it = spawn_worker();
+        }
+        else if (m_sessions > 0){
+            m_sessions--;
+        }
+    }
+}
+
+//::::::::::::::::::::: ADMISSION CONTROL :::::::::::::::::::::://
+/**
+ * Token bucket admission control. Each client IP has a bucket 
+ * which holds up to burst tokens and is refilled at rate tokens
+ * per second; each request takes one token. A client with an 
+ * empty bucket is over its budget.
+ * Note that with a worker pool the workers accept TCP sessions
+ * directly, so only UDP requests go through here; the number of
+ * concurrent sessions is then bounded by the size of the pool.
+ * 
+ * @param buckets the buckets of each client IP
+ * @param ip the IP of the client making the request
+ * @param rate the refill rate (requests per second)
+ * @param burst the maximum number of tokens
+ * @return true if the request is admitted
+ * @return false if it must be rejected
+ */
+bool Server::admit(map<in_addr_t, BUCKET> & buckets, in_addr_t ip, double rate, double burst){
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    map<in_addr_t, BUCKET>::iterator it = buckets.find(ip);
+    if (it == buckets.end()){
+        if ((int) buckets.size() >= MAX_BUCKETS){
+            prune_buckets(buckets, rate, burst);
+        }
+        BUCKET fresh;
+        fresh.tokens = burst;
+        fresh.last = now;
+        it = buckets.insert(make_pair(ip, fresh)).first;
+    }
+
+    BUCKET & b = it->second;
+    double elapsed = (now.tv_sec - b.last.tv_sec) + (now.tv_usec - b.last.tv_usec) / 1000000.0;
+    b.tokens = min(burst, b.tokens + elapsed * rate);
+    b.last = now;
+
+    if (b.tokens < 1){
+        if (m_verbose) fprintf(stdout, "Request from %s rejected: over budget\n", inet_ntoa(*(struct in_addr *) &ip));
+        return false;
+    }
+    b.tokens -= 1;
+    return true;
+}
+
+/**
+ * Forgets the buckets that would already be full again. Those 
+ * clients are indistinguishable from new ones, so this keeps the
+ * buckets from growing without limit. If none of them is full, 
+ * the least recently used ones are forgotten instead.
+ * 
+ * @param buckets the buckets of each client IP
+ * @param rate the refill rate (requests per second)
+ * @param burst the maximum number of tokens
+ */
+void Server::prune_buckets(map<in_addr_t, BUCKET> & buckets, double rate, double burst){
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    map<in_addr_t, BUCKET>::iterator it = buckets.begin();
+    while (it != buckets.end()){
+        double elapsed = (now.tv_sec - it->second.last.tv_sec);
+        if (it->second.tokens + elapsed * rate >= burst){
+            buckets.erase(it++);
+        }
+        else{
+            ++it;
         }
     }
+    if ((int) buckets.size() < MAX_BUCKETS){
+        return;
+    }
+
+    vector<pair<double, in_addr_t>> oldest;
+    for (it = buckets.begin(); it != buckets.end(); ++it){
+        oldest.push_back(make_pair(it->second.last.tv_sec + it->second.last.tv_usec / 1000000.0, it->first));
+    }
+    int evict = (int) buckets.size() - MAX_BUCKETS + MAX_BUCKETS / 16;
+    nth_element(oldest.begin(), oldest.begin() + evict - 1, oldest.end());
+    for (int i = 0; i < evict; i++){
+        buckets.erase(oldest[i].second);
+    }
+}
+
+/**
+ * Rejects a TCP session right after it is accepted, answering BSY
+ * so the client knows it may try again later.
+ * 
+ * @param connfd the file descriptor of the accepted connection
+ */
+void Server::reject_connection(int connfd){
+    SOCKET s;
+    s.fd = connfd;
+    strcpy(s.owner, SERVER);
+    sendstatusTCP(&s, "", BUSY);
+    close(connfd);
+}
+
+/**
+ * Prints the DS statistics: the load shed by admission control 
+ * and the number of open sessions.
+ */
+void Server::print_stats(){
+    fprintf(stdout, "Open TCP sessions: %d\n", m_sessions);
+    fprintf(stdout, "Rejected UDP requests (over budget): %ld\n", m_shed_udp);
+    fprintf(stdout, "Rejected TCP sessions (over budget): %ld\n", m_shed_tcp_rate);
+    fprintf(stdout, "Rejected TCP sessions (too many open): %ld\n", m_shed_tcp_full);
+    fflush(stdout);
 }
 
 //:::::::::::::::::: CONDITIONS VALIDATION :::::::::::::::::::://
@@ -343,7 +945,7 @@ int Server::validate_user(const char * uid){
 
     sprintf(pathname, "%s/%s", USERS, uid);
     DIR * dir = opendir(pathname);
-    if(opendir(pathname) == NULL){
+    if(dir == NULL){
         return INVALID;
     }
     closedir(dir);
@@ -467,6 +1069,7 @@ void Server::init_groups_dir(GROUPLIST * groups){
         bzero(groups->group_no[i], MAX_GID + 1);
         bzero(groups->group_name[i], MAX_GID + 1);
         bzero(groups->group_mid[i], MAX_GID + 1);
+        groups->group_version[i] = 0;
     }
 }
 
@@ -505,7 +1108,10 @@ int Server::list_groups_dir(GROUPLIST * groups, const char * uid){
                 sprintf(gnamefilepath, "GROUPS/%s/%s_name.txt", gid, gid);
 
                 FILE * gnamefile = fopen(gnamefilepath, "r");
-                if (!gnamefile) return FAIL;
+                if (!gnamefile){
+                    closedir(d);
+                    return FAIL;
+                }
 
                 char gname[MAX_GNAME + 1] = {'\0'};
                 int nread = fread(gname, 1, MAX_GNAME, gnamefile);
@@ -522,6 +1128,11 @@ int Server::list_groups_dir(GROUPLIST * groups, const char * uid){
                 sprintf(mid, "%04d", mid_n);
 
                 strcpy(groups->group_mid[atoi(gid) - 1], mid);
+
+                /* Get the version of its last change */
+                char versionfilepath[MAX_PATHNAME] = {'\0'};
+                sprintf(versionfilepath, "GROUPS/%s/%s_version.txt", gid, gid);
+                groups->group_version[atoi(gid) - 1] = read_version(versionfilepath);
             }
         }
         closedir(d);
@@ -531,24 +1142,257 @@ int Server::list_groups_dir(GROUPLIST * groups, const char * uid){
 }
 
 /**
- * Counts the number of messages a certain group, given by GID, 
- * contains.
+ * Gets the UID of each subscriber of a group, given by GID: each
+ * one has a GROUPS/GID/UID.txt file.
  * 
  * @param gid the GID parameter
- * @return int the number of messages of that group
+ * @param uids gets the UID of each subscriber
+ * @return int the number of subscribers or FAIL
  */
-int Server::count_mid(char * gid){
-    char msgdirpath[MAX_PATHNAME] = {'\0'};
-    sprintf(msgdirpath, "GROUPS/%s/MSG", gid);
-    int mid = 0;
+int Server::list_subscribers(char * gid, vector<string> & uids){
+    char pathname[MAX_PATHNAME] = {'\0'};
+    sprintf(pathname, "GROUPS/%s", gid);
 
-    DIR * msgdir = opendir(msgdirpath);
-    struct dirent * msgdirent;
+    DIR * d = opendir(pathname);
+    if (!d){
+        return FAIL;
+    }
+    struct dirent * dir;
+    while ((dir = readdir(d)) != NULL){
+        if (dir->d_type != DT_REG) continue;
+        if ((strlen(dir->d_name) != MAX_UID + 4) || strcmp(dir->d_name + MAX_UID, ".txt")) continue;
+
+        string uid = string(dir->d_name, MAX_UID);
+        if (!parse_uid(uid)) continue;
+        uids.push_back(uid);
+    }
+    closedir(d);
+    return uids.size();
+}
+
+/**
+ * Writes a page of a list of groups, in ascending order of GID,
+ * as it follows the answer code.
+ * Format: N[ GID GName MID]*
+ * 
+ * @param groups the list of groups
+ * @param since only the groups changed after this catalog version
+ * are written (0 for all of them)
+ * @param first the lowest GID of the page
+ * @param count the maximum number of groups of the page
+ * @return string the page
+ */
+string Server::serialize_groups(GROUPLIST * groups, long since, int first, int count){
+    string page;
+    int n = 0;
+    for (int i = max(first, 1) - 1; (i < MAX_NGROUPS) && (n < count); i++){
+        if (groups->group_no[i][0] == '\0') continue;
+
+        /* A group without a stamp counts as changed */
+        if ((since == 0) || (groups->group_version[i] == 0) || (groups->group_version[i] > since)){
+            n++;
+            page += " " + string(groups->group_no[i]) + " " + string(groups->group_name[i]) + " " + string(groups->group_mid[i]);
+        }
+    }
+    return " " + to_string(n) + page;
+}
+
+/**
+ * Gets the catalog version: a counter, kept in GROUPS/version.txt,
+ * bumped by every change which shows on a list of groups (a new 
+ * group, a new message or a new subscription). Each change leaves
+ * a stamp with the version it bumped to, so a listing can skip 
+ * the groups which didn't change since the version a client has.
+ * The counter is read before scanning the groups: a change which
+ * isn't seen yet always gets a stamp above it, under the lock.
+ * 
+ * @return long the catalog version
+ */
+long Server::catalog_version(){
+    char pathname[MAX_PATHNAME] = {'\0'};
+    sprintf(pathname, "%s/version.txt", GROUPS);
+
+    int fd = open(pathname, O_RDONLY);
+    if (fd == FAIL){
+        return 0;
+    }
+    flock(fd, LOCK_SH);
+    char counter[MAX_VERSION + 1] = {'\0'};
+    int nread = pread(fd, counter, MAX_VERSION, 0);
+    flock(fd, LOCK_UN);
+    close(fd);
+    return (nread > 0) ? atol(counter) : 0;
+}
+
+/**
+ * Bumps the catalog version and stamps a change with it, by wri-
+ * ting the new version to the given stamp file(s), while holding
+ * the lock of the counter.
+ * 
+ * @param pathname the stamp file (e.g. GROUPS/GID/GID_version.txt)
+ * @param also another stamp file, or NULL
+ * @return long the new version or FAIL
+ */
+long Server::stamp_version(const char * pathname, const char * also){
+    char counterpath[MAX_PATHNAME] = {'\0'};
+    sprintf(counterpath, "%s/version.txt", GROUPS);
+
+    int fd = open(counterpath, O_RDWR | O_CREAT, 0600);
+    if (fd == FAIL){
+        fprintf(stderr, "Unable to open %s file.\n", counterpath);
+        return FAIL;
+    }
+    flock(fd, LOCK_EX);
+
+    char counter[MAX_STRING] = {'\0'};
+    int nread = pread(fd, counter, MAX_VERSION, 0);
+    long version = ((nread > 0) ? atol(counter) : 0) + 1;
+    int len = sprintf(counter, "%ld", version);
+
+    long status = version;
+    if (pwrite(fd, counter, len, 0) != len){
+        status = FAIL;
+    }
+    const char * stamps[] = {pathname, also};
+    for (int i = 0; (i < 2) && (stamps[i] != NULL); i++){
+        FILE * stamp = fopen(stamps[i], "w");
+        if (!stamp || (fwrite(counter, 1, len, stamp) < (size_t) len)){
+            fprintf(stderr, "Unable to stamp %s file.\n", stamps[i]);
+            status = FAIL;
+        }
+        if (stamp){
+            fclose(stamp);
+        }
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    return status;
+}
+
+/**
+ * Gets the list of all groups. It's only scanned again when the 
+ * catalog version changed since the last time (a new group or a
+ * new message), and so is the GLS answer, which is kept ready to
+ * be sent.
+ * 
+ * @param version gets the catalog version of the list
+ * @return GROUPLIST* the list of all groups
+ */
+GROUPLIST * Server::cached_catalog(long * version){
+    *version = catalog_version();
+    if (*version != m_catalog_version){
+        init_groups_dir(m_catalog);
+        list_groups_dir(m_catalog, NULL);
+        m_groups_answer = string(USER_GROUPS_ANSWER) + serialize_groups(m_catalog, 0, 1, MAX_NGROUPS) + "\n";
+        m_catalog_version = *version;
+    }
+    return m_catalog;
+}
+
+/**
+ * Stamps every group which has no stamp yet (e.g. one created be-
+ * fore the catalog was versioned), so delta listings see it, and
+ * indexes the messages of every group which has no index yet.
+ */
+void Server::stamp_groups(){
+    DIR * d = opendir(GROUPS);
+    if (!d){
+        return;
+    }
+    struct dirent * dir;
+    while ((dir = readdir(d)) != NULL){
+        if ((dir->d_type != DT_DIR) || !parse_gid(dir->d_name)) continue;
+
+        char gid[MAX_GID + 1] = {'\0'};
+        strncpy(gid, dir->d_name, MAX_GID);
+
+        char versionfilepath[MAX_PATHNAME] = {'\0'};
+        sprintf(versionfilepath, "%s/%s/%s_version.txt", GROUPS, gid, gid);
+        if (read_version(versionfilepath) == 0){
+            stamp_version(versionfilepath);
+        }
+
+        char indexpath[MAX_PATHNAME] = {'\0'};
+        sprintf(indexpath, "%s/%s/%s_index.txt", GROUPS, gid, gid);
+        if (access(indexpath, F_OK) == FAIL){
+            index_messages(gid, indexpath);
+        }
+    }
+    closedir(d);
+}
+
+/**
+ * Writes the index of a group, given by GID, which has none (e.g.
+ * one whose messages were posted before groups were indexed): the
+ * MIDs of its published messages, in the order of their sequence
+ * numbers (see publish). Messages without one aren't published, so
+ * they're left out.
+ * 
+ * @param gid the GID of the group
+ * @param indexpath the path of the index
+ */
+void Server::index_messages(char * gid, char * indexpath){
+    vector<pair<long, int>> published;
+    for (int mid = count_mid(gid); mid > 0; mid--){
+        char path[MAX_PATHNAME] = {'\0'};
+        sprintf(path, "GROUPS/%s/MSG/%04d/A U T H O R.txt", gid, mid);
+        if (access(path, F_OK) == FAIL) continue;
+
+        sprintf(path, "GROUPS/%s/MSG/%04d/S E Q.txt", gid, mid);
+        long seq = read_version(path);
+        if (seq > 0) published.push_back({seq, mid});
+    }
+    sort(published.begin(), published.end());
+
+    string index;
+    for (size_t i = 0; i < published.size(); i++){
+        char record[INDEX_RECORD + 1] = {'\0'};
+        sprintf(record, "%04u\n", (unsigned) published[i].second % 10000);
+        index += record;
+    }
+    if (write_file(index.c_str(), indexpath) == FAIL){
+        fprintf(stderr, "Unable to write %s file.\n", indexpath);
+    }
+}
+
+/**
+ * Reads the catalog version of a stamp file.
+ * 
+ * @param pathname the stamp file
+ * @return long the version, or 0 if there's no stamp
+ */
+long Server::read_version(const char * pathname){
+    char counter[MAX_VERSION + 1] = {'\0'};
+    int n = read_file(counter, (char *) pathname, MAX_VERSION);
+    if (n <= 0){
+        return 0;
+    }
+    counter[n] = '\0';
+    return atol(counter);
+}
+
+/**
+ * Gets the last MID of a certain group, given by GID: the highest
+ * one claimed, even if its message isn't complete. A MID whose 
+ * post failed is kept as an empty directory (see abandon_mid), but
+ * the highest MID is taken anyway, so a gap never hides the MIDs 
+ * after it.
+ * 
+ * @param gid the GID parameter
+ * @return int the last MID of that group, or 0 if it has none
+ */
+int Server::count_mid(char * gid){
+    char msgdirpath[MAX_PATHNAME] = {'\0'};
+    sprintf(msgdirpath, "GROUPS/%s/MSG", gid);
+    int mid = 0;
+
+    DIR * msgdir = opendir(msgdirpath);
+    struct dirent * msgdirent;
     if (msgdir){
         while ((msgdirent = readdir(msgdir)) != NULL){
             if (msgdirent->d_type == DT_DIR){
-                if (parse_mid(string(msgdirent->d_name))){
-                    mid++;
+                if (parse_mid(msgdirent->d_name)){
+                    mid = max(mid, atoi(msgdirent->d_name));
                 }
             }
         }
@@ -557,6 +1401,224 @@ int Server::count_mid(char * gid){
     return mid;
 }
 
+/**
+ * Lists the complete messages (the ones with an author) of a cer-
+ * tain group, given by GID, starting with a certain MID.
+ * 
+ * @param gid the GID of the group
+ * @param first the MID to start with
+ * @param count the maximum number of messages listed
+ * @param mids gets the MIDs of the messages
+ * @return int the MID after the last one looked at
+ */
+int Server::list_messages(char * gid, int first, int count, vector<int> & mids){
+    int last = count_mid(gid);
+    int mid = max(first, 1);
+    for (; (mid <= last) && ((int) mids.size() < count); mid++){
+        char path[MAX_PATHNAME] = {'\0'};
+        sprintf(path, "GROUPS/%s/MSG/%04d/A U T H O R.txt", gid, mid);
+        if (access(path, F_OK) != FAIL){
+            mids.push_back(mid);
+        }
+    }
+    return mid;
+}
+
+/**
+ * Lists the last complete messages (the ones with an author) of a
+ * certain group, given by GID, from its MID counter backwards.
+ * 
+ * @param gid the GID of the group
+ * @param count the maximum number of messages listed
+ * @param mids gets the MIDs of the messages, the oldest first
+ */
+void Server::list_latest(char * gid, int count, vector<int> & mids){
+    for (int mid = count_mid(gid); (mid > 0) && ((int) mids.size() < count); mid--){
+        char path[MAX_PATHNAME] = {'\0'};
+        sprintf(path, "GROUPS/%s/MSG/%04d/A U T H O R.txt", gid, mid);
+        if (access(path, F_OK) != FAIL){
+            mids.push_back(mid);
+        }
+    }
+    reverse(mids.begin(), mids.end());
+}
+
+/**
+ * Allocates the MID of a new message of a certain group, given by
+ * GID, by creating its GROUPS/GID/MSG/MID directory.
+ * Each group keeps its own MID counter (its MSG directory), so 
+ * posts to different groups never share any state. Since mkdir is
+ * atomic, two sessions posting to the same group at once can't 
+ * get the same MID: the one who loses the race simply tries the 
+ * next MID, without any lock.
+ * 
+ * @param gid the GID parameter
+ * @param mid the allocated MID
+ * @return int the allocated MID or FAIL
+ */
+int Server::claim_mid(char * gid, char * mid){
+    char dirname[MAX_DIRNAME];
+
+    for (int mid_n = count_mid(gid) + 1; mid_n <= MAX_MESSAGES; mid_n++){
+        sprintf(mid, "%04d", mid_n);
+        sprintf(dirname, "GROUPS/%s/MSG/%s", gid, mid);
+        if (mkdir(dirname, 0700) == SUCCESS){
+            return mid_n;
+        }
+        if (errno != EEXIST){
+            fprintf(stderr, "Unable to create %s directory.\n", dirname);
+            return FAIL;
+        }
+    }
+    return FAIL;
+}
+
+/**
+ * Abandons a message of a certain group, given by GID and MID, 
+ * whose post failed: whatever was written of it is deleted, but
+ * its directory is kept, empty, so its MID is never reused and the
+ * listings (which skip messages without an author) skip it.
+ * 
+ * @param gid the GID parameter
+ * @param mid the MID parameter
+ * @param fname the name of its file, or "" if there's none
+ */
+void Server::abandon_mid(char * gid, char * mid, const char * fname){
+    const char * names[] = {"A U T H O R.txt", "T E X T.txt", "F N A M E.txt", "S E Q.txt"};
+    char path[MAX_PATHNAME] = {'\0'};
+    for (int i = 0; i < 4; i++){
+        sprintf(path, "GROUPS/%s/MSG/%s/%s", gid, mid, names[i]);
+        unlink(path);
+    }
+    if (fname[0] != '\0'){
+        sprintf(path, "GROUPS/%s/MSG/%s/%s", gid, mid, fname);
+        unlink(path);
+    }
+}
+
+/**
+ * Allocates the ID of a new upload, by creating its UPLOADS/ID 
+ * directory (the staging area of the upload). Like a MID, the ID
+ * belongs to whoever creates the directory first.
+ * 
+ * @param id gets the ID of the upload
+ * @return int SUCCESS or FAIL
+ */
+int Server::claim_upload(char * id){
+    if ((mkdir(UPLOADS, 0700) == FAIL) && (errno != EEXIST)){
+        fprintf(stderr, "Unable to create %s directory.\n", UPLOADS);
+        return FAIL;
+    }
+
+    char dirname[MAX_DIRNAME];
+    unsigned seed = (unsigned) getpid() * 7919u + (unsigned) time(NULL);
+    for (unsigned i = 0; i < 100; i++){
+        sprintf(id, "%08u", (seed + i) % 100000000u);
+        sprintf(dirname, "%s/%s", UPLOADS, id);
+        if (mkdir(dirname, 0700) == SUCCESS){
+            return SUCCESS;
+        }
+        if (errno != EEXIST){
+            fprintf(stderr, "Unable to create %s directory.\n", dirname);
+            return FAIL;
+        }
+    }
+    return FAIL;
+}
+
+/**
+ * Gets the size of the attachment of an upload and the number of
+ * bytes of it received so far, if the upload belongs to the user.
+ * 
+ * @param uid the UID of the user
+ * @param id the ID of the upload
+ * @param fsize gets the size of the attachment
+ * @return long the number of bytes received, or FAIL
+ */
+long Server::upload_received(const char * uid, const char * id, long * fsize){
+    char path[MAX_PATHNAME] = {'\0'};
+    char owner[MAX_UID + 1] = {'\0'};
+    sprintf(path, "%s/%s/A U T H O R.txt", UPLOADS, id);
+    if ((read_file(owner, path, MAX_UID) != MAX_UID) || strcmp(owner, uid)){
+        return FAIL;
+    }
+
+    char size[MAX_FSIZE + 1] = {'\0'};
+    sprintf(path, "%s/%s/F S I Z E.txt", UPLOADS, id);
+    if (read_file(size, path, MAX_FSIZE) <= 0){
+        return FAIL;
+    }
+    *fsize = atol(size);
+
+    struct stat info;
+    sprintf(path, "%s/%s/D A T A", UPLOADS, id);
+    if (stat(path, &info) == FAIL){
+        return 0;
+    }
+    return min((long) info.st_size, *fsize);
+}
+
+/**
+ * Discards the uploads left idle for longer than UPLOAD_TTL (the
+ * last chunk received is the last activity), and counts the ones
+ * left of a user, given by UID.
+ * 
+ * @param uid the UID of the user
+ * @return int the number of open uploads of the user
+ */
+int Server::sweep_uploads(const char * uid){
+    DIR * d = opendir(UPLOADS);
+    if (!d){
+        return 0;
+    }
+
+    int open = 0;
+    time_t now = time(NULL);
+    struct dirent * dir;
+    while ((dir = readdir(d)) != NULL){
+        if ((strlen(dir->d_name) != MAX_UPLOAD_ID) || !all_of_class(dir->d_name, CLASS_DIGIT)) continue;
+        char id[MAX_UPLOAD_ID + 1] = {'\0'};
+        strncpy(id, dir->d_name, MAX_UPLOAD_ID);
+
+        char path[MAX_PATHNAME] = {'\0'};
+        struct stat info;
+        time_t last = 0;
+        sprintf(path, "%s/%s", UPLOADS, id);
+        if (stat(path, &info) == SUCCESS) last = info.st_mtime;
+        sprintf(path, "%s/%s/D A T A", UPLOADS, id);
+        if (stat(path, &info) == SUCCESS) last = max(last, info.st_mtime);
+
+        if (now - last > UPLOAD_TTL){
+            discard_upload(id);
+            continue;
+        }
+
+        char owner[MAX_UID + 1] = {'\0'};
+        sprintf(path, "%s/%s/A U T H O R.txt", UPLOADS, id);
+        if ((read_file(owner, path, MAX_UID) == MAX_UID) && !strcmp(owner, uid)){
+            open++;
+        }
+    }
+    closedir(d);
+    return open;
+}
+
+/**
+ * Deletes the staging area of an upload, given by its ID.
+ * 
+ * @param id the ID of the upload
+ */
+void Server::discard_upload(const char * id){
+    const char * staged[] = {"G I D.txt", "T E X T.txt", "F N A M E.txt", "F S I Z E.txt", "A U T H O R.txt", "D A T A"};
+    char path[MAX_PATHNAME] = {'\0'};
+    for (int i = 0; i < 6; i++){
+        sprintf(path, "%s/%s/%s", UPLOADS, id, staged[i]);
+        unlink(path);
+    }
+    sprintf(path, "%s/%s", UPLOADS, id);
+    rmdir(path);
+}
+
 /**
  * Determins the first GID available (not already created). 
  * 
@@ -600,6 +1662,25 @@ int Server::read_file(char * data, char * path, int bytes){
     return FAIL;
 }
 
+/**
+ * Writes a string to a file, given the path of the file (which is
+ * created or truncated).
+ * 
+ * @param data the string to be written
+ * @param path the path of the file
+ * @return int SUCCESS or FAIL
+ */
+int Server::write_file(const char * data, char * path){
+    FILE * fp = fopen(path, "w");
+    if (!fp){
+        return FAIL;
+    }
+    size_t len = strlen(data);
+    int status = (fwrite(data, 1, len, fp) == len) ? SUCCESS : FAIL;
+    fclose(fp);
+    return status;
+}
+
 /**
  * If the DS Server is operating in verbose mode, it outputs a 
  * short description of the received requests (UID, GID) and the
@@ -670,14 +1751,8 @@ string Server::get_clientport(SOCKET * s){
 void Server::reg(string uid, string pass){
     if (m_verbose) print_verbose(socketUDP, USER_REG, uid, "");
     
-    /** 
-     * 1. Parameters verification 
-     * Expected format: REG UID pass
-    */
-    if (!parse_uid(uid) || !parse_pass(pass)){
-        sendstatusUDP(socketUDP, USER_REG_ANSWER, ERR);
-        return;
-    }
+    /* 1. Parameters verification: already done by the request 
+    schema (REG UID pass) */
 
     /* 2. Check for duplicate user */
     if (validate_user(uid.c_str()) != INVALID){
@@ -691,6 +1766,7 @@ void Server::reg(string uid, string pass){
      *  a) create the directory associated with the new user
      *  b) inside that directory, create the file which contains
      * the user's pass
+     *  c) stamp the subscriptions of the user
      */
 
     /* a) Create the directory USERS/UID */
@@ -720,6 +1796,13 @@ void Server::reg(string uid, string pass){
     }
 
     fclose(passfile);
+
+    /* c) Stamp the subscriptions of the user, so that a my_groups
+    cached for a previous user with this UID isn't taken as valid */
+    char versionfilepath[MAX_PATHNAME] = {'\0'};
+    sprintf(versionfilepath, "USERS/%s/%s_version.txt", uid.c_str(), uid.c_str());
+    stamp_version(versionfilepath);
+
     sendstatusUDP(socketUDP, USER_REG_ANSWER, OK);
     return;
 }
@@ -734,14 +1817,8 @@ void Server::reg(string uid, string pass){
 void Server::unregister(string uid, string pass){
     if (m_verbose) print_verbose(socketUDP, USER_UNREGISTER, uid, "");
     
-    /** 
-     * 1. Parameters verification 
-     * Expected format: UNR UID pass
-    */
-    if (!parse_uid(uid) || !parse_pass(pass)){
-        sendstatusUDP(socketUDP, USER_UNREGISTER_ANSWER, ERR);
-        return;
-    }
+    /* 1. Parameters verification: already done by the request 
+    schema (UNR UID pass) */
 
     /**
      * 2. Conditions for valid unregister
@@ -782,6 +1859,22 @@ void Server::unregister(string uid, string pass){
         return;
     }
 
+    /* Delete the file USERS/UID/UID_version.txt (if present) */
+    char versionfilepath[MAX_PATHNAME] = {'\0'};
+    sprintf(versionfilepath, "USERS/%s/%s_version.txt", uid.c_str(), uid.c_str());
+    if (delete_file(versionfilepath) != SUCCESS){
+        sendstatusUDP(socketUDP, USER_UNREGISTER_ANSWER, NOK);
+        return;
+    }
+
+    /* Delete the file USERS/UID/UID_inbox.txt (if present) */
+    char inboxfilepath[MAX_PATHNAME] = {'\0'};
+    sprintf(inboxfilepath, "USERS/%s/%s_inbox.txt", uid.c_str(), uid.c_str());
+    if (delete_file(inboxfilepath) != SUCCESS){
+        sendstatusUDP(socketUDP, USER_UNREGISTER_ANSWER, NOK);
+        return;
+    }
+
     /* c) Delete the directory USERS/UID */
     char directoryfilepath[MAX_PATHNAME] = {'\0'};
     sprintf(directoryfilepath, "USERS/%s", uid.c_str());
@@ -813,14 +1906,8 @@ void Server::unregister(string uid, string pass){
 void Server::login(string uid, string pass){
     if (m_verbose) print_verbose(socketUDP, USER_LOGIN, uid, "");
 
-    /** 
-     * 1. Parameters verification 
-     * Expected format: LOG UID pass
-    */
-    if (!parse_uid(uid) || !parse_pass(pass)){
-        sendstatusUDP(socketUDP, USER_LOGIN_ANSWER, ERR);
-        return;
-    }
+    /* 1. Parameters verification: already done by the request 
+    schema (LOG UID pass) */
 
     /**
      * 2. Conditions for valid login
@@ -859,14 +1946,8 @@ void Server::login(string uid, string pass){
 void Server::logout(string uid, string pass){
     if (m_verbose) print_verbose(socketUDP, USER_LOGOUT, uid, "");
 
-    /** 
-     * 1. Parameters verification 
-     * Expected format: OUT UID pass
-    */
-    if (!parse_uid(uid) || !parse_pass(pass)){
-        sendstatusUDP(socketUDP, USER_LOGOUT_ANSWER, ERR);
-        return;
-    }
+    /* 1. Parameters verification: already done by the request 
+    schema (OUT UID pass) */
 
     /**
      * 2. Conditions for valid logout
@@ -900,35 +1981,39 @@ void Server::logout(string uid, string pass){
 
 /**
  * Executes the request corresponding to the groups command.
- * The DS server sends the information of the available groups.
+ * The DS server sends the information of the available groups:
+ * all of them (GLS), one page (GLP), or one page of those which
+ * changed since a catalog version (GLD).
+ * 
+ * @param answer the answer code: RGL, RGP or RGD
+ * @param delta whether it's a GLD request
+ * @param since the catalog version the client has (GLD only)
+ * @param first the lowest GID of the page
+ * @param count the maximum number of groups of the page
  */
-void Server::groups(){
+void Server::groups(const char * answer, bool delta, long since, int first, int count){
     if (m_verbose) print_verbose(socketUDP, USER_GROUPS, "", "");
         
     /**
      * 1. Execute request; send answer
-     * Format: RGl N[ GID GName MID]*
+     * Format: RGL N[ GID GName MID]*, RGP N[ GID GName MID]* or
+     * RGD Version Since N[ GID GName MID]*
      */
+    long version;
+    GROUPLIST * groups = cached_catalog(&version);
 
-    GROUPLIST * groups = (GROUPLIST * )malloc(sizeof(GROUPLIST));
-    
-    init_groups_dir(groups);
-    int N = list_groups_dir(groups, NULL);
-
-    string answer = string(USER_GROUPS_ANSWER) + " " + to_string(N); 
+    /* The whole list (GLS) is sent as it was cached */
+    if (strcmp(answer, USER_GROUPS_ANSWER) == SUCCESS){
+        sendUDP(socketUDP, m_groups_answer);
+        return;
+    }
 
-    int ndone = 0;
-    while (ndone < N){
-        for (int i = 0; i < MAX_NGROUPS; i++){
-            if (atoi(groups->group_no[i]) != 0){
-                ndone++;
-                answer += " " + string(groups->group_no[i]) + " " + string(groups->group_name[i]) + " " + string(groups->group_mid[i]);
-            }
-        }
+    string message = string(answer);
+    if (delta){
+        message += " " + to_string(version) + " " + to_string(since);
     }
-    free(groups);
-    answer += "\n";
-    sendUDP(socketUDP, answer);
+    message += serialize_groups(groups, since, first, count) + "\n";
+    sendUDP(socketUDP, message);
 }
 
 /**
@@ -945,21 +2030,13 @@ void Server::subscribe(string uid, string gid, string gname){
     string answer;
 
     /** 
-     * 1. Parameters verification 
-     * Expected format: GSR UID GID GName
+     * 1. Parameters verification: the format (GSR UID GID GName)
+     * was already checked by the request schema
     */
-    if(!parse_uid(uid) || !validate_user(uid.c_str())){
+    if(!validate_user(uid.c_str())){
         sendstatusUDP(socketUDP, USER_SUBSCRIBE_ANSWER, E_USR);
         return;
     }
-    else if(!parse_gid(gid)){
-        sendstatusUDP(socketUDP, USER_SUBSCRIBE_ANSWER, E_GRP);
-        return;
-    }
-    else if(!parse_gname(gname)){
-        sendstatusUDP(socketUDP, USER_SUBSCRIBE_ANSWER, E_GNAME);
-        return;
-    }
 
     /* In the case the number of groups have reached the maximum number allowed */
     int group_no = count_gid();
@@ -1035,6 +2112,13 @@ void Server::subscribe(string uid, string gid, string gname){
             sendstatusUDP(socketUDP, USER_SUBSCRIBE_ANSWER, NOK);
             return;
         }
+
+        /* 5) Stamp the new group and the subscriptions of the user */
+        sprintf(pathname, "GROUPS/%02d/%02d_version.txt", new_gid, new_gid);
+        stamp_version(pathname);
+        sprintf(pathname, "USERS/%s/%s_version.txt", uid.c_str(), uid.c_str());
+        stamp_version(pathname);
+
         /**
          * 3. Send answer 
          * Format: RGS NEW GID
@@ -1085,6 +2169,11 @@ void Server::subscribe(string uid, string gid, string gname){
          */
 
         fclose(uid_file);
+
+        /* 4) Stamp the subscriptions of the user */
+        sprintf(pathname, "USERS/%s/%s_version.txt", uid.c_str(), uid.c_str());
+        stamp_version(pathname);
+
         sendstatusUDP(socketUDP, USER_SUBSCRIBE_ANSWER, OK);
         return;
     }
@@ -1107,15 +2196,8 @@ void Server::unsubscribe(string uid, string gid){
      * status = {OK, E_USR, E_GRP, NOK}
      */
 
-    /* 1. Parameters verification */
-    if (!check_uid(uid, USER_UNSUBSCRIBE)) {
-        sendstatusUDP(socketUDP, USER_UNSUBSCRIBE_ANSWER, E_USR);
-        return;
-    }
-    if (!check_gid(gid, USER_UNSUBSCRIBE)) {
-        sendstatusUDP(socketUDP, USER_UNSUBSCRIBE_ANSWER, E_GRP);
-        return;
-    }
+    /* 1. Parameters verification: already done by the request 
+    schema */
 
     /* 2. Conditions for valid unsubscribe verification 
      * Steps:
@@ -1157,61 +2239,70 @@ void Server::unsubscribe(string uid, string gid){
             handle_error(SERVER, OTHER);
             return;
     }
+
+    /* Stamp the subscriptions of the user */
+    sprintf(pathname, "USERS/%s/%s_version.txt", uid.c_str(), uid.c_str());
+    stamp_version(pathname);
+
     sendstatusUDP(socketUDP, USER_UNSUBSCRIBE_ANSWER, OK);
 }
 
 /**
  * Executes the request corresponding to a my_groups command.
  * The DS server sends the informations of subscribed groups
- * by the user, given by its UID
+ * by the user, given by its UID: all of them (GLM), one page 
+ * (GMP), or one page of those which changed since a catalog ver-
+ * sion (GMD). If the subscriptions of the user changed since 
+ * then, GMD lists all of them, with Since = 0.
  * 
  * @param uid the UID parameter
+ * @param answer the answer code: RGM, RMP or RMD
+ * @param delta whether it's a GMD request
+ * @param since the catalog version the client has (GMD only)
+ * @param first the lowest GID of the page
+ * @param count the maximum number of groups of the page
  */
-void Server::my_groups(string uid){
+void Server::my_groups(string uid, const char * answer, bool delta, long since, int first, int count){
     if (m_verbose) print_verbose(socketUDP, USER_MY_GROUPS, uid, "");
 
-    /* 1. Parameters verification */
-    if (!parse_uid(uid)){
-        sendstatusUDP(socketUDP, USER_MY_GROUPS_ANSWER, E_USR);
-        return;
-    }
+    /* 1. Parameters verification: already done by the request 
+    schema */
 
     /**
      * 2. Conditions for valid my_groups verification: the user
      * needs to exist and be logged in.
      */
     if(validate_user(uid.c_str()) != VALID){
-        sendstatusUDP(socketUDP, USER_MY_GROUPS_ANSWER, E_USR);
+        sendstatusUDP(socketUDP, answer, E_USR);
         return;
     }
 
     /**
      * 3. Execute request; send answer
-     * Format: RGM N[ GID GName MID]*
+     * Format: RGM N[ GID GName MID]*, RMP N[ GID GName MID]* or
+     * RMD Version Since N[ GID GName MID]*
      */
+    long version = catalog_version();
+
+    char versionfilepath[MAX_PATHNAME] = {'\0'};
+    sprintf(versionfilepath, "USERS/%s/%s_version.txt", uid.c_str(), uid.c_str());
+    if (read_version(versionfilepath) > since){
+        since = 0;
+    }
 
     GROUPLIST * groups = (GROUPLIST * )malloc(sizeof(GROUPLIST));
     init_groups_dir(groups);
 
-    int N = list_groups_dir(groups, uid.c_str());
-
-    string answer = string(USER_MY_GROUPS_ANSWER) + " " + to_string(N); 
+    list_groups_dir(groups, uid.c_str());
 
-    int ndone = 0;
-    while (ndone < N){
-        for (int i = 0; i < MAX_NGROUPS; i++){
-            if (atoi(groups->group_no[i]) != 0){
-                ndone++;
-                answer += " " + string(groups->group_no[i]) + " " + string(groups->group_name[i]) + " " + string(groups->group_mid[i]);
-            }
-        }
+    string message = string(answer);
+    if (delta){
+        message += " " + to_string(version) + " " + to_string(since);
     }
-    
+    message += serialize_groups(groups, since, first, count) + "\n";
     free(groups);
 
-    answer += "\n";
-
-    sendUDP(socketUDP, answer);
+    sendUDP(socketUDP, message);
 }
 
 /**
@@ -1231,10 +2322,20 @@ void Server::ulist(){
     }
     gid[MAX_GID] = '\0';
 
+    ulist_execute(gid);
+}
+
+/**
+ * Executes an ulist request whose parameters were already recei-
+ * ved, either from a text or a framed (v2) request.
+ * 
+ * @param gid the GID of the group
+ */
+void Server::ulist_execute(char * gid){
     /* 2. Parameters verification */
     if (validate_group(gid, NULL) == INVALID){
         sendstatusTCP(sTCP, USER_ULIST_ANSWER, NOK);
-        disconnect(sTCP);
+        finish_request();
         return;
     }
 
@@ -1260,7 +2361,8 @@ void Server::ulist(){
     }
     char gname[MAX_GNAME + 1] = {'\0'};
     fread(gname, 1, MAX_GNAME, gnamefile);
-    if (!parse_gname(string(gname))){
+    fclose(gnamefile);
+    if (!parse_gname(gname)){
         sendstatusTCP(sTCP, USER_ULIST_ANSWER, NOK);
         disconnect(sTCP);
         return;
@@ -1273,52 +2375,26 @@ void Server::ulist(){
         return;
     }
 
-    /* 2b) Get each subscriber of the group and add to answer */    
-    /* Get the name of the GName file */
-    char gnamepath[MAX_PATHNAME] = {'\0'};
-    sprintf(gnamepath, "%s_name.txt", gid);
-    
-    /* Get the name of the group directory */
-    char pathname[MAX_PATHNAME] = {'\0'};
-    sprintf(pathname, "GROUPS/%s", gid);
-    DIR * d;
-    struct dirent * dir;
-    d = opendir(pathname);
-    if (d) {
-        /* Read each entry */
-        while ((dir = readdir(d)) != NULL) {
-            /* If that directory is a file, we will see if cor-
-            responds to a subscribed user */
-            if (dir->d_type == DT_REG) {
-                char fname[MAX_PATHNAME + 1] = {'\0'};
-                strcpy(fname, dir->d_name);
-                                
-                /* If it corresponds to a subscribed user, send 
-                its respective UID */
-                if (strcmp(gnamepath, fname) != SUCCESS){
-                    char uid[MAX_UID + 1] = {'\0'};
-                    strncpy(uid, fname, MAX_UID);
-                    uid[MAX_UID] = '\0';
-
-                    if (!parse_uid(string(uid))) continue;
-
-                    string ans_uid = " " + string(uid);
-
-                    if (sendTCP(sTCP, ans_uid, ans_uid.size()) == FAIL){
-                        disconnect(sTCP);
-                        return;
-                    }
-                }
-            }
-        }
-        closedir(d);
+    /* 2b) Get each subscriber of the group and add to answer, 
+    in one go */
+    vector<string> uids;
+    list_subscribers(gid, uids);
+
+    string subscribers;
+    for (size_t i = 0; i < uids.size(); i++){
+        subscribers += " " + uids[i];
     }
-    /* Need to add the '\n' at the end. Note we don't check if 
-    this call failed. This is because whatever the result, the 
-    function will return. The specific user who needed the action 
+    if (!subscribers.empty() && (sendTCP(sTCP, subscribers, subscribers.size()) == FAIL)){
+        disconnect(sTCP);
+        return;
+    }
+
+    /* Need to add the '\n' at the end. Note we don't check if 
+    this call failed. This is because whatever the result, the 
+    function will return. The specific user who needed the action 
     may be harmed, but the server will carry on */
-    sendTCP(sTCP, "\n\0", 2);
-    disconnect(sTCP);
+    sendTCP(sTCP, "\n", 1);
+    finish_request();
 }
 
 /**
@@ -1328,7 +2404,7 @@ void Server::ulist(){
  */
 void Server::post(){
     /** 
-     * 1. Receiving parameters: UID GID Tsize text
+     * 1. Receiving parameters: UID GID Tsize text[ Fname Fsize]
      */
     /* Get UID */
     char uid[MAX_UID + 1] = {'\0'};
@@ -1352,8 +2428,6 @@ void Server::post(){
     }
     gid[MAX_GID] = '\0';
 
-    if (m_verbose) print_verbose(sTCP, USER_POST, string(uid), string(gid));
-
     /* Get Tsize */
     char tsize[MAX_TSIZE + 1] = {'\0'};
     int res3 = tsize_receiveTCP(sTCP, tsize, USER_POST);
@@ -1375,89 +2449,13 @@ void Server::post(){
         return;
     }
 
-    /**
-     * 2. Execute request Part 1
-     * Steps:
-     * a) Determine the new MID
-     * b) Create "GROUPS/GID/MSG/MID" directory
-     * c) Create "A U T H O R.txt" file in GROUPS/GID/MSG/MID
-     * d) Create "T E X T.txt" file in GROUPS/GID/MSG/MID
-     * e) Create "F N A M E.txt" file in GROUPS/GID/MSG/MID
-     * 
-     */
-
-    /* 3.a) Determine the new MID */
-
-    int mid_n = count_mid(gid) + 1;
-    char mid[MAX_MID + 1] = {'\0'};
-    sprintf(mid, "%04d", mid_n);
-    mid[MAX_MID] = '\0';
-
-    /* 3.b) Create "GROUPS/GID/MSG/MID" directory */
-    char dirname[MAX_DIRNAME];
-    sprintf(dirname, "GROUPS/%2s/MSG/%4s", gid, mid);
-    if (create_dir(dirname) == FAIL){
-        sendstatusTCP(sTCP, USER_POST_ANSWER, NOK);
-        disconnect(sTCP);
-        return;
-    }
-
-    /* 3.c) Create "A U T H O R.txt" file in GROUPS/GID/MSG/MID */
-    FILE* author_file;
-    char pathname[MAX_PATHNAME];
-
-    sprintf(pathname, "GROUPS/%2s/MSG/%4s/A U T H O R.txt", gid, mid);
-    if (!(author_file = fopen(pathname, "w"))){
-        sendstatusTCP(sTCP, USER_POST_ANSWER, NOK);
-        disconnect(sTCP);
-        return;
-    }
-
-    if (fwrite(uid, 1, strlen(uid), author_file) < string(uid).length()){
-        remove(pathname);
-        fclose(author_file);
-        sendstatusTCP(sTCP, USER_POST_ANSWER, NOK);
-        disconnect(sTCP);
-        return;
-    }
-    fclose(author_file);
-
-    /* 3.d) Create "T E X T.txt" file in GROUPS/GID/MSG/MID */
-    FILE* text_file;
-
-    sprintf(pathname, "GROUPS/%2s/MSG/%4s/T E X T.txt", gid, mid);
-    if (!(text_file = fopen(pathname, "w"))){
-        sendstatusTCP(sTCP, USER_POST_ANSWER, NOK);
-        disconnect(sTCP);
-        return;
-    }
-
-    if (fwrite(text, 1, strlen(text), text_file) < string(text).length()){
-        remove(pathname);
-        fclose(text_file);
-        sendstatusTCP(sTCP, USER_POST_ANSWER, NOK);
-        disconnect(sTCP);
-        return;
-    }
-
-    fclose(text_file);
-
-    /**
-     * 4. Execute request Part 2
-     * Steps:
-     * a) Determine if a file was sent.
-     */
-
     /* A file was not sent */
     if(last_caracter == '\n'){
-        sendstatusTCP(sTCP, USER_POST_ANSWER, mid);
+        post_execute(uid, gid, text, (char *) "", 0);
+        return;
     }
-    /* A file was sent */
+    /* A file was sent: get Fname and Fsize; the data follows */
     else if(last_caracter == ' '){
-        /** 
-         * 2. Receiving parameters: Fname Fsize data
-        */
-
         /* Receiving fname */
         char fname[MAX_FNAME + 1] = {'\0'};
         int res5 = fname_receiveTCP(sTCP, fname, USER_POST);
@@ -1478,211 +2476,1358 @@ void Server::post(){
             return;
         }
 
+        post_execute(uid, gid, text, fname, atol(fsize));
+        return;
+    }
+
+    sendstatusTCP(sTCP, USER_POST_ANSWER, NOK);
+    disconnect(sTCP);
+}
+
+/**
+ * Executes a post request whose parameters were already received,
+ * either from a text or a framed (v2) request. If there's a file,
+ * its data is the only part of the request still to be received.
+ * 
+ * @param uid the UID of the author
+ * @param gid the GID of the group
+ * @param text the text of the message
+ * @param fname the name of the file, or "" if there's none
+ * @param fsize the size of the file
+ */
+void Server::post_execute(char * uid, char * gid, char * text, char * fname, long fsize){
+    if (m_verbose) print_verbose(sTCP, USER_POST, string(uid), string(gid));
+
+    /**
+     * 2. Execute request Part 1
+     * Steps:
+     * a) Determine the new MID and 
+     * b) Create "GROUPS/GID/MSG/MID" directory (in a single step)
+     * c) Create "T E X T.txt" file in GROUPS/GID/MSG/MID
+     * 
+     */
+
+    /* 3.a) and 3.b) Claim the new MID by creating "GROUPS/GID/MSG/MID" */
+    char mid[MAX_MID + 1] = {'\0'};
+    if (claim_mid(gid, mid) == FAIL){
+        sendstatusTCP(sTCP, USER_POST_ANSWER, NOK);
+        disconnect(sTCP);
+        return;
+    }
+    mid[MAX_MID] = '\0';
+
+    /* 3.c) Create "T E X T.txt" file in GROUPS/GID/MSG/MID */
+    char pathname[MAX_PATHNAME];
+
+    sprintf(pathname, "GROUPS/%2s/MSG/%4s/T E X T.txt", gid, mid);
+    if (write_file(text, pathname) == FAIL){
+        abandon_mid(gid, mid, fname);
+        sendstatusTCP(sTCP, USER_POST_ANSWER, NOK);
+        disconnect(sTCP);
+        return;
+    }
+
+    /**
+     * 4. Execute request Part 2
+     * Steps:
+     * a) If a file was sent, receive it and create "F N A M E.txt"
+     * file in GROUPS/GID/MSG/MID
+     * b) Create "A U T H O R.txt" file in GROUPS/GID/MSG/MID, which 
+     * makes the message complete: until then, it isn't listed. If 
+     * anything fails, the MID is abandoned (see abandon_mid)
+     */
+    if (fname[0] != '\0'){
         /* Receiving data and creating a file with it in the pathname below */
         sprintf(pathname, "GROUPS/%2s/MSG/%4s/%s", gid, mid, fname);
-        if(receivefileTCP(sTCP, pathname, atoi(fsize))==FAIL){
+        if(receivefileTCP(sTCP, pathname, fsize)==FAIL){
+            abandon_mid(gid, mid, fname);
             sendstatusTCP(sTCP, USER_POST_ANSWER, NOK);
             disconnect(sTCP);
             return;
         }
-        
-        /* Create "F N A M E.txt" file in GROUPS/GID/MSG/MID */
-        FILE* fname_file;
 
-        sprintf(pathname, "GROUPS/%s/MSG/%s/F N A M E.txt", gid, mid);
-        if (!(fname_file = fopen(pathname, "w"))){
+        /* Receiving the '\n' which ends a text request (a framed one 
+        ends with the data) */
+        char end = '\0';
+        if (!m_framed && ((receiveTCP(sTCP, &end, 1) < 1) || (end != '\n'))){
+            abandon_mid(gid, mid, fname);
             sendstatusTCP(sTCP, USER_POST_ANSWER, NOK);
             disconnect(sTCP);
             return;
         }
 
-        if (fwrite(fname, 1, strlen(fname), fname_file) < string(fname).length()){
-            remove(pathname);
-            fclose(fname_file);
+        sprintf(pathname, "GROUPS/%s/MSG/%s/F N A M E.txt", gid, mid);
+        if (write_file(fname, pathname) == FAIL){
+            abandon_mid(gid, mid, fname);
             sendstatusTCP(sTCP, USER_POST_ANSWER, NOK);
             disconnect(sTCP);
             return;
         }
-        fclose(fname_file);
-
-        sendstatusTCP(sTCP, USER_POST_ANSWER, mid);
     }
-    else{
+
+    sprintf(pathname, "GROUPS/%2s/MSG/%4s/A U T H O R.txt", gid, mid);
+    if (write_file(uid, pathname) == FAIL){
+        abandon_mid(gid, mid, fname);
         sendstatusTCP(sTCP, USER_POST_ANSWER, NOK);
+        disconnect(sTCP);
+        return;
     }
-    
-    disconnect(sTCP);
+
+    publish(gid, mid);
+    sendstatusTCP(sTCP, USER_POST_ANSWER, mid);
+    finish_request();
 }
 
 /**
- * @brief 
- * 
+ * Executes the request corresponding to the opening of an upload
+ * (a post with -u). The text and the name and size of the file 
+ * are kept in the staging area of a new upload, whose ID is sent 
+ * back; the data is then sent in chunks (see upload_chunk).
  */
-void Server::retrieve(){
-    /** 
-     * 1. Receive and verify parameters: UID GID MID
-     */
-    /* Get UID */
+void Server::upload_open(){
+    /* 1. Read the rest of the request: UID GID Tsize text Fname Fsize */
     char uid[MAX_UID + 1] = {'\0'};
-    int res1 = uid_receiveTCP(sTCP, uid, USER_RETRIEVE);
-    if (res1 == FAIL) return;
-    if (!res1){
-        sendstatusTCP(sTCP, USER_RETRIEVE_ANSWER, NOK);
-        disconnect(sTCP);
-        return;
-    }
-    uid[MAX_UID] = '\0'; 
+    int res = uid_receiveTCP(sTCP, uid, USER_POST);
+    if (res == FAIL) return;
 
-    /* Get GID */
     char gid[MAX_GID + 1] = {'\0'};
-    int res2 = gid_receiveTCP(sTCP, gid, USER_RETRIEVE);
-    if (res2 == FAIL) return;
-    if (!res2){
-        sendstatusTCP(sTCP, USER_RETRIEVE_ANSWER, NOK);
+    res = res ? gid_receiveTCP(sTCP, gid, USER_POST) : 0;
+    if (res == FAIL) return;
+
+    char tsize[MAX_TSIZE + 1] = {'\0'};
+    res = res ? tsize_receiveTCP(sTCP, tsize, USER_POST) : 0;
+    if (res == FAIL) return;
+
+    char text[MAX_TEXT + 1] = {'\0'};
+    char last_caracter = '\0';
+    res = res ? text_receiveTCP(sTCP, text, stoi(string(tsize)), USER_POST, &last_caracter) : 0;
+    if (res == FAIL) return;
+
+    char fname[MAX_FNAME + 1] = {'\0'};
+    res = (res && (last_caracter == ' ')) ? fname_receiveTCP(sTCP, fname, USER_POST) : 0;
+    if (res == FAIL) return;
+
+    char fsize[MAX_FSIZE + 2] = {'\0'};
+    res = res ? fsize_receiveTCP(sTCP, fsize, USER_POST) : 0;
+    if (res == FAIL) return;
+    if (!res){
+        sendstatusTCP(sTCP, USER_UPLOAD_OPEN_ANSWER, NOK);
         disconnect(sTCP);
         return;
     }
-    gid[MAX_GID] = '\0'; 
 
-    if (m_verbose) print_verbose(sTCP, USER_RETRIEVE, string(uid), string(gid));
+    if (m_verbose) print_verbose(sTCP, USER_POST, string(uid), string(gid));
 
-    /* Get MID */
-    char mid[MAX_MID + 1] = {'\0'};
-    int res3 = mid_receiveTCP(sTCP, mid, USER_RETRIEVE);
-    if (res3 == FAIL) return;
-    if (!res3){
-        sendstatusTCP(sTCP, USER_RETRIEVE_ANSWER, NOK);
-        disconnect(sTCP);
+    /* 2. Conditions for valid upload verification: the user needs
+    to exist, be logged in and be subscribed to the group */
+    if ((validate_user(uid) != VALID) || (validate_group(gid, uid) != VALID)){
+        sendstatusTCP(sTCP, USER_UPLOAD_OPEN_ANSWER, NOK);
+        finish_request();
         return;
     }
-    mid[MAX_MID] = '\0'; 
 
-    /* 2. Conditions for valid retrieve verification 
-     * Steps:
-     * a) validate user (exists and is logged in)
-     * b) valid gid (exists and the user subscribed to the group)
+    /**
+     * 3. Execute request: stale uploads are swept first, and a user
+     * can't keep more than MAX_UPLOADS open
+     * Format: RUO OK ID
      */
-    if(validate_user(uid) != VALID){
-        sendstatusTCP(sTCP, USER_RETRIEVE_ANSWER, NOK);
-        disconnect(sTCP);
+    char id[MAX_UPLOAD_ID + 1] = {'\0'};
+    if ((sweep_uploads(uid) >= MAX_UPLOADS) || (claim_upload(id) == FAIL)){
+        sendstatusTCP(sTCP, USER_UPLOAD_OPEN_ANSWER, NOK);
+        finish_request();
         return;
     }
-    
-    if(validate_group(gid, uid) != VALID){
-        sendstatusTCP(sTCP, USER_RETRIEVE_ANSWER, NOK);
+
+    const char * names[] = {"G I D.txt", "T E X T.txt", "F N A M E.txt", "F S I Z E.txt", "A U T H O R.txt"};
+    const char * values[] = {gid, text, fname, fsize, uid};
+    for (int i = 0; i < 5; i++){
+        char path[MAX_PATHNAME] = {'\0'};
+        sprintf(path, "%s/%s/%s", UPLOADS, id, names[i]);
+        if (write_file(values[i], path) == FAIL){
+            discard_upload(id);
+            sendstatusTCP(sTCP, USER_UPLOAD_OPEN_ANSWER, NOK);
+            finish_request();
+            return;
+        }
+    }
+
+    sendstatusTCP(sTCP, USER_UPLOAD_OPEN_ANSWER, string(OK) + " " + string(id));
+    finish_request();
+}
+
+/**
+ * Executes the request corresponding to a chunk of an upload. The
+ * chunk is written at its offset, which can't be past the bytes 
+ * received so far; the bytes of a chunk which breaks are kept, so
+ * the user only sends the ones after them again.
+ */
+void Server::upload_chunk(){
+    /* 1. Read the rest of the request: UID ID Offset Size; the data 
+    follows */
+    char uid[MAX_UID + 1] = {'\0'};
+    int res = uid_receiveTCP(sTCP, uid, USER_POST);
+    if (res == FAIL) return;
+
+    char id[MAX_UPLOAD_ID + 2] = {'\0'};
+    char offset[MAX_FSIZE + 2] = {'\0'};
+    char size[MAX_FSIZE + 2] = {'\0'};
+    if (res){
+        word_receiveTCP(sTCP, id, MAX_UPLOAD_ID + 1);
+        res = (strlen(id) == MAX_UPLOAD_ID) && all_of_class(id, CLASS_DIGIT);
+    }
+    res = res ? fsize_receiveTCP(sTCP, offset, USER_POST) : 0;
+    if (res == FAIL) return;
+    res = res ? fsize_receiveTCP(sTCP, size, USER_POST) : 0;
+    if (res == FAIL) return;
+
+    /* 2. Conditions for valid chunk verification: the user needs 
+    to exist, be logged in and own the upload, and the chunk can't
+    leave a gap or go past the end of the file */
+    long fsize = 0;
+    long received = FAIL;
+    if (res && (validate_user(uid) == VALID)){
+        received = upload_received(uid, id, &fsize);
+    }
+    if ((received == FAIL) || (atol(offset) > received) || (atol(offset) + atol(size) > fsize)){
+        sendstatusTCP(sTCP, USER_UPLOAD_CHUNK_ANSWER, NOK);
         disconnect(sTCP);
         return;
     }
 
+    if (m_verbose) print_verbose(sTCP, USER_POST, string(uid), "");
+
     /**
      * 3. Execute request
-     * Steps:
-     *  a) Get and send N (number of messages retrieved)
-     *  b) For each message:
-     *      1) Get MID
-     *      2) Get UID
-     *      3) Get Tsize and text
-     *      4) Send MID UID Tsize text
-     *      5) Get and send Fname Fsize
-     *      6) Send data
-     */ 
-    /* a) Calculate and send N */
-    int group_mid = count_mid(gid);
-    int asked_mid = stoi(mid);
-    int N = group_mid - asked_mid + 1;
-
-    if (N > 20){
-        N = asked_mid + 19;
-    }
-    if (N <= 0){
-        sendstatusTCP(sTCP, USER_RETRIEVE_ANSWER, EOF_);
+     * Format: RUC OK Received
+     */
+    char path[MAX_PATHNAME] = {'\0'};
+    sprintf(path, "%s/%s/D A T A", UPLOADS, id);
+    char end = '\0';
+    if ((receiverangeTCP(sTCP, path, atol(offset), atol(size)) == FAIL)
+        || (receiveTCP(sTCP, &end, 1) < 1) || (end != '\n')){
         disconnect(sTCP);
         return;
     }
 
-    string buffer = string(USER_RETRIEVE_ANSWER) + " " + string(OK) + " " + to_string(N);
+    received = upload_received(uid, id, &fsize);
+    sendstatusTCP(sTCP, USER_UPLOAD_CHUNK_ANSWER, string(OK) + " " + to_string(received));
+    finish_request();
+}
 
-    if (sendTCP(sTCP, buffer, buffer.size()) == FAIL){
+/**
+ * Executes the request corresponding to a query (UPQ) or to the 
+ * commit (UPF) of an upload. A query gets the number of bytes re-
+ * ceived so far. Once every byte was received, the commit posts 
+ * the message: its files are written to the directory of a new 
+ * MID, then the file is moved there from the staging area, and 
+ * the message is only complete (it gets an author) after that, so
+ * no one sees it half written. If any step fails, the upload is 
+ * left as it was and the MID is given back.
+ * 
+ * @param commit whether the upload is committed
+ */
+void Server::upload_finish(bool commit){
+    const char * answer = commit ? USER_UPLOAD_COMMIT_ANSWER : USER_UPLOAD_QUERY_ANSWER;
+
+    /* 1. Read the rest of the request: UID ID */
+    char uid[MAX_UID + 1] = {'\0'};
+    int res = uid_receiveTCP(sTCP, uid, USER_POST);
+    if (res == FAIL) return;
+
+    char id[MAX_UPLOAD_ID + 2] = {'\0'};
+    char delimiter = '\0';
+    if (res){
+        word_receiveTCP(sTCP, id, MAX_UPLOAD_ID + 1, &delimiter);
+        res = (strlen(id) == MAX_UPLOAD_ID) && all_of_class(id, CLASS_DIGIT) && (delimiter == '\n');
+    }
+    if (!res){
+        sendstatusTCP(sTCP, answer, NOK);
         disconnect(sTCP);
         return;
     }
 
-    /* b) Send each message */
-    for (int i = 0; i < N; i++){
-        char path[MAX_PATHNAME] = {'\0'};
+    if (m_verbose) print_verbose(sTCP, USER_POST, string(uid), "");
 
-        /* 1) MID */
-        char messageid[MAX_MID + 1] = {'\0'};
-        sprintf(messageid, "%04d", i + asked_mid);
-        messageid[MAX_MID] = '\0';
+    /* 2. Conditions for valid query/commit verification: the user 
+    needs to exist, be logged in and own the upload */
+    long fsize = 0;
+    long received = (validate_user(uid) == VALID) ? upload_received(uid, id, &fsize) : FAIL;
+    if (received == FAIL){
+        sendstatusTCP(sTCP, answer, NOK);
+        finish_request();
+        return;
+    }
 
-        /* 2) UID */
-        sprintf(path, "GROUPS/%s/MSG/%s/A U T H O R.txt", gid, messageid);
-        char userid[MAX_UID + 1] = {'\0'};
-        if(read_file(userid, path, MAX_UID) != MAX_UID){
-            disconnect(sTCP);
-            return;
-        }
-        userid[MAX_UID] = '\0';
-        
-        /* 3) Tsize and text */
-        char text[MAX_TEXT + 1] = {'\0'};
-        int tsize = 0;
+    /**
+     * 3. Execute request
+     * Format: RUQ OK Received or RUF MID
+     */
+    if (!commit){
+        sendstatusTCP(sTCP, answer, string(OK) + " " + to_string(received));
+        finish_request();
+        return;
+    }
 
-        sprintf(path, "GROUPS/%s/MSG/%s/T E X T.txt", gid, messageid);
-        if((tsize = read_file(text, path, MAX_TEXT)) == FAIL){
-            disconnect(sTCP);
-            return;
-        }
-        text[tsize] = '\0';
+    char gid[MAX_GID + 1] = {'\0'};
+    char text[MAX_TEXT + 1] = {'\0'};
+    char fname[MAX_FNAME + 1] = {'\0'};
+    char path[MAX_PATHNAME] = {'\0'};
+    sprintf(path, "%s/%s/G I D.txt", UPLOADS, id);
+    read_file(gid, path, MAX_GID);
+    sprintf(path, "%s/%s/T E X T.txt", UPLOADS, id);
+    read_file(text, path, MAX_TEXT);
+    sprintf(path, "%s/%s/F N A M E.txt", UPLOADS, id);
+    read_file(fname, path, MAX_FNAME);
 
-        /* 4) send MID UID Tsize text */
-        buffer = " " + string(messageid) + " " + string(userid) + " " + to_string(tsize) + " " + string(text);
+    char mid[MAX_MID + 1] = {'\0'};
+    if ((received < fsize) || (validate_group(gid, uid) != VALID) || (claim_mid(gid, mid) == FAIL)){
+        sendstatusTCP(sTCP, answer, NOK);
+        finish_request();
+        return;
+    }
 
-        /* Check if there's a file */
-        sprintf(path, "GROUPS/%s/MSG/%s/F N A M E.txt", gid, messageid);
-        char fname[MAX_FNAME + 1] = {'\0'};
+    /* An empty file was never written */
+    sprintf(path, "%s/%s/D A T A", UPLOADS, id);
+    if (fsize == 0){
+        write_file("", path);
+    }
 
-        int n = read_file(fname, path, MAX_FNAME);
-        switch(n){
-            case FAIL:
-                disconnect(sTCP);
-                return;
-            case NO_FILE:
-                if(sendTCP(sTCP, buffer, buffer.size()) == FAIL){
-                    disconnect(sTCP);
-                    return;
-                }
-                continue;
+    /* a) The text and the name of the file; b) the file; c) the 
+    author, which makes the message complete */
+    char msgpath[MAX_PATHNAME] = {'\0'};
+    char filepath[MAX_PATHNAME] = {'\0'};
+    sprintf(filepath, "GROUPS/%s/MSG/%s/%s", gid, mid, fname);
+
+    const char * names[] = {"T E X T.txt", "F N A M E.txt", "A U T H O R.txt"};
+    const char * values[] = {text, fname, uid};
+    bool done = true;
+    for (int i = 0; done && (i < 2); i++){
+        sprintf(msgpath, "GROUPS/%s/MSG/%s/%s", gid, mid, names[i]);
+        done = (write_file(values[i], msgpath) == SUCCESS);
+    }
+    bool moved = done && (rename(path, filepath) == SUCCESS);
+    if (moved){
+        sprintf(msgpath, "GROUPS/%s/MSG/%s/%s", gid, mid, names[2]);
+        done = (write_file(values[2], msgpath) == SUCCESS);
+    }
+    done = done && moved;
+    if (!done){
+        if (moved){
+            rename(filepath, path);
         }
+        abandon_mid(gid, mid, "");
+        sendstatusTCP(sTCP, answer, NOK);
+        finish_request();
+        return;
+    }
 
-        /* 5) Get and send " / Fname Fsize " */
-        sprintf(path, "GROUPS/%s/MSG/%04d/%s", gid, i + asked_mid, fname);
-        FILE * file = fopen(path, "r");
-        fseek(file, 0, SEEK_END);
-        int fsize = ftell(file);
-        fseek(file, 0, SEEK_SET);
+    /* The staging area of the upload is no longer needed */
+    discard_upload(id);
 
-        buffer += " / " + string(fname) + " " + to_string(fsize) + " ";
-        if(sendTCP(sTCP, buffer, buffer.length()) == FAIL){
-            disconnect(sTCP);
-            return;
-        }
+    publish(gid, mid);
+    sendstatusTCP(sTCP, answer, mid);
+    finish_request();
+}
 
-        /* 6) Send data */
-        if(sendfileTCP(sTCP, file) == FAIL){
-            fclose(file);
-            disconnect(sTCP);
-            return;
+/**
+ * Publishes a new message, given by GID and MID, once it's com-
+ * plete: it gets its sequence number (the catalog version it bumps
+ * to, also the stamp of its group), which orders the messages of
+ * every group, and the users waiting for it are notified.
+ * Its MID is also appended to the index of its group, while hol-
+ * ding the lock of the index, so the index keeps the messages of
+ * the group in the order of their sequence numbers (see feed).
+ * 
+ * @param gid the GID of the group
+ * @param mid the MID of the new message
+ */
+void Server::publish(char * gid, char * mid){
+    char seqpath[MAX_PATHNAME] = {'\0'};
+    sprintf(seqpath, "GROUPS/%s/MSG/%s/S E Q.txt", gid, mid);
+    char versionpath[MAX_PATHNAME] = {'\0'};
+    sprintf(versionpath, "GROUPS/%s/%s_version.txt", gid, gid);
+    char indexpath[MAX_PATHNAME] = {'\0'};
+    sprintf(indexpath, "GROUPS/%s/%s_index.txt", gid, gid);
+
+    int fd = open(indexpath, O_WRONLY | O_APPEND | O_CREAT, 0600);
+    if (fd != FAIL){
+        flock(fd, LOCK_EX);
+    }
+    stamp_version(seqpath, versionpath);
+    if (fd != FAIL){
+        char record[INDEX_RECORD + 1] = {'\0'};
+        sprintf(record, "%s\n", mid);
+        if (write(fd, record, INDEX_RECORD) != INDEX_RECORD){
+            fprintf(stderr, "Unable to index message %s of group %s.\n", mid, gid);
         }
-        fclose(file);
+        flock(fd, LOCK_UN);
+        close(fd);
     }
 
-    if(sendTCP(sTCP, "\n", 1) == FAIL){
-        disconnect(sTCP);
+    notify_watchers(gid, mid);
+    if (m_fanout) fan_out(gid, mid);
+}
+
+/**
+ * Notifies the users watching a group, given by GID, of a new mes-
+ * sage, given by MID. Each watcher has a FIFO in GROUPS/GID/WATCH 
+ * for each group it watches, where the notification is written:
+ * it's shorter than PIPE_BUF, so it's never mixed with another.
+ * The notification is dropped if the FIFO is full, and the FIFO 
+ * of a watcher which is gone is deleted.
+ * 
+ * @param gid the GID of the group
+ * @param mid the MID of the new message
+ */
+void Server::notify_watchers(char * gid, char * mid){
+    char dirname[MAX_DIRNAME] = {'\0'};
+    sprintf(dirname, "%s/%s/%s", GROUPS, gid, WATCH);
+
+    DIR * d = opendir(dirname);
+    if (!d){
         return;
     }
-    disconnect(sTCP);
+
+    char note[MAX_NOTE + 1] = {'\0'};
+    sprintf(note, "%s %s\n", gid, mid);
+
+    struct dirent * dir;
+    while ((dir = readdir(d)) != NULL){
+        if (dir->d_name[0] == '.') continue;
+
+        string fifopath = string(dirname) + "/" + string(dir->d_name);
+
+        int fd = open(fifopath.c_str(), O_WRONLY | O_NONBLOCK);
+        if (fd == FAIL){
+            /* No one reads the FIFO: the watcher is gone */
+            if (errno == ENXIO) unlink(fifopath.c_str());
+            continue;
+        }
+        if (write(fd, note, MAX_NOTE) < MAX_NOTE){
+            fprintf(stderr, "Unable to notify %s watcher.\n", fifopath.c_str());
+        }
+        close(fd);
+    }
+    closedir(d);
+}
+
+/**
+ * Delivers a new message, given by GID and MID, to the inbox of 
+ * every subscriber of its group (-f). Each inbox is a ring of the
+ * last INBOX_SIZE notifications (see INBOX): when it's full, the 
+ * oldest one is dropped. Inboxes are locked one at a time, so 
+ * posts to different groups only meet at a common subscriber.
+ * 
+ * @param gid the GID of the group
+ * @param mid the MID of the new message
+ */
+void Server::fan_out(char * gid, char * mid){
+    vector<string> uids;
+    list_subscribers(gid, uids);
+
+    char note[MAX_NOTE + 1] = {'\0'};
+    sprintf(note, "%s %s\n", gid, mid);
+
+    for (size_t i = 0; i < uids.size(); i++){
+        char pathname[MAX_PATHNAME] = {'\0'};
+        sprintf(pathname, "USERS/%s/%s_inbox.txt", uids[i].c_str(), uids[i].c_str());
+
+        int fd = open(pathname, O_RDWR | O_CREAT, 0600);
+        if (fd == FAIL) continue;
+        flock(fd, LOCK_EX);
+
+        INBOX box;
+        read_inbox(fd, &box);
+        memcpy(box.notes[(box.head + box.count) % INBOX_SIZE], note, MAX_NOTE);
+        if (box.count < INBOX_SIZE){
+            box.count++;
+        }
+        else{
+            box.head = (box.head + 1) % INBOX_SIZE;
+            box.first++;
+        }
+        if (pwrite(fd, &box, sizeof(INBOX), 0) != sizeof(INBOX)){
+            fprintf(stderr, "Unable to deliver to %s inbox.\n", pathname);
+        }
+
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+}
+
+/**
+ * Reads the inbox of a user from its (locked) file. An inbox that
+ * can't be read, or makes no sense, is taken as empty.
+ * 
+ * @param fd the file descriptor of the inbox file
+ * @param box gets the inbox
+ */
+void Server::read_inbox(int fd, INBOX * box){
+    if ((pread(fd, box, sizeof(INBOX), 0) != sizeof(INBOX)) || (box->first < 0) || (box->count < 0) 
+        || (box->count > INBOX_SIZE) || (box->head < 0) || (box->head >= INBOX_SIZE)){
+        memset(box, 0, sizeof(INBOX));
+    }
+}
+
+/**
+ * Executes the request corresponding to an inbox command. The DS
+ * server sends the notifications in the inbox of a user, given by
+ * its UID, oldest first. Each notification has a sequence number,
+ * and the user acknowledges the ones it got by sending back the 
+ * next sequence number of the last answer: only those are removed,
+ * so the notifications of an answer which was lost are sent again.
+ * 
+ * @param uid the UID parameter
+ * @param ack the sequence number after the last notification the
+ * user got
+ */
+void Server::inbox(string uid, long ack){
+    if (m_verbose) print_verbose(socketUDP, USER_INBOX, uid, "");
+
+    /* 1. Parameters verification: already done by the request 
+    schema */
+
+    /**
+     * 2. Conditions for valid inbox verification: the DS needs to
+     * deliver posts to inboxes (-f), and the user needs to exist 
+     * and be logged in.
+     */
+    if (!m_fanout){
+        sendstatusUDP(socketUDP, USER_INBOX_ANSWER, NOK);
+        return;
+    }
+    if (validate_user(uid.c_str()) != VALID){
+        sendstatusUDP(socketUDP, USER_INBOX_ANSWER, E_USR);
+        return;
+    }
+
+    /**
+     * 3. Execute request; send answer
+     * Format: RIB Next N[ GID MID]*
+     */
+    char pathname[MAX_PATHNAME] = {'\0'};
+    sprintf(pathname, "USERS/%s/%s_inbox.txt", uid.c_str(), uid.c_str());
+
+    INBOX box;
+    memset(&box, 0, sizeof(INBOX));
+
+    int fd = open(pathname, O_RDWR);
+    if (fd != FAIL){
+        flock(fd, LOCK_EX);
+        read_inbox(fd, &box);
+
+        /* An acknowledgment past the last notification is from an
+        inbox which no longer exists: nothing is removed */
+        long acked = ack - box.first;
+        if ((acked > 0) && (acked <= box.count)){
+            box.head = (box.head + acked) % INBOX_SIZE;
+            box.count -= acked;
+            box.first = ack;
+            pwrite(fd, &box, sizeof(INBOX), 0);
+        }
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+
+    string answer = string(USER_INBOX_ANSWER) + " " + to_string(box.first + box.count) + " " + to_string(box.count);
+    for (int i = 0; i < box.count; i++){
+        answer += " " + string(box.notes[(box.head + i) % INBOX_SIZE], MAX_NOTE - 1);
+    }
+    answer += "\n";
+    sendUDP(socketUDP, answer);
+}
+
+/**
+ * Executes the request corresponding to a watch command. The DS
+ * server keeps the session open and pushes a notification to the
+ * user, given by its UID, each time a message is posted to one of
+ * the groups it's subscribed to, until the user closes it.
+ * A watch may last for hours, so it's handed to a process of its 
+ * own (see watch_session): the worker (or the session slot) is
+ * free for the next session at once.
+ */
+void Server::watch(){
+    /* 1. Read the rest of the request: UID */
+    char uid[MAX_UID + 1] = {'\0'};
+    int res = uid_receiveTCP(sTCP, uid, USER_WATCH);
+    if (res == FAIL) return;
+    if (!res){
+        sendstatusTCP(sTCP, USER_WATCH_ANSWER, NOK);
+        disconnect(sTCP);
+        return;
+    }
+    uid[MAX_UID] = '\0';
+
+    if (m_verbose) print_verbose(sTCP, USER_WATCH, string(uid), "");
+
+    /* 2. Conditions for valid watch verification: the user needs
+    to exist and be logged in */
+    if (validate_user(uid) != VALID){
+        sendstatusTCP(sTCP, USER_WATCH_ANSWER, NOK);
+        disconnect(sTCP);
+        return;
+    }
+
+    /* 3. Execute request: the watch is served by a grandchild, so
+    no one has to wait for it to end (it's reaped by init) */
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0){
+        if (fork() == 0){
+            /* A worker still holds the listening socket */
+            if (m_nworkers > 0) close(socketTCP->fd);
+            watch_session(uid);
+            exit(EXIT_SUCCESS);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    if (pid == FAIL){
+        sendstatusTCP(sTCP, USER_WATCH_ANSWER, NOK);
+    }
+    else{
+        waitpid(pid, NULL, 0);
+    }
+    disconnect(sTCP);
+}
+
+/**
+ * Serves a watch session, given by the UID of the user. The ses-
+ * sion joins the watchers of each group (a FIFO in the group's 
+ * WATCH directory, see notify_watchers) and waits for either a 
+ * notification or the end of the session. A quiet session gets a
+ * heartbeat (an empty line) every WATCH_HEARTBEAT seconds, so a 
+ * user that is gone is noticed, and no session lasts longer than
+ * WATCH_TIMEOUT seconds.
+ * 
+ * @param uid the UID parameter
+ */
+void Server::watch_session(char * uid){
+    if (!join_watchers()){
+        sendstatusTCP(sTCP, "", BUSY);
+        disconnect(sTCP);
+        return;
+    }
+
+    /**
+     * a) Create the FIFO of the session in the WATCH directory of
+     * the first subscribed group, and link it to the others
+     * b) Answer; then relay the notifications until the session
+     * ends
+     * c) Leave the watchers of every group
+     * Format: RWT OK, then GID MID for each new message
+     */
+    GROUPLIST * groups = (GROUPLIST * )malloc(sizeof(GROUPLIST));
+    init_groups_dir(groups);
+    list_groups_dir(groups, uid);
+
+    char fifopath[MAX_PATHNAME] = {'\0'};
+    vector<string> links;
+    for (int i = 0; i < MAX_NGROUPS; i++){
+        if (groups->group_no[i][0] == '\0') continue;
+
+        char dirname[MAX_DIRNAME] = {'\0'};
+        sprintf(dirname, "%s/%s/%s", GROUPS, groups->group_no[i], WATCH);
+        if ((mkdir(dirname, 0700) == FAIL) && (errno != EEXIST)) continue;
+
+        char pathname[MAX_PATHNAME] = {'\0'};
+        sprintf(pathname, "%s/%d", dirname, getpid());
+        unlink(pathname);
+        int made = links.empty() ? mkfifo(pathname, 0600) : link(fifopath, pathname);
+        if (made == FAIL){
+            fprintf(stderr, "Unable to create %s FIFO.\n", pathname);
+            continue;
+        }
+        if (links.empty()){
+            strcpy(fifopath, pathname);
+        }
+        links.push_back(string(pathname));
+    }
+    free(groups);
+
+    /* The session also keeps the FIFO open for writing, so it's 
+    never left without writers between two notifications */
+    int rfd = FAIL, wfd = FAIL;
+    if (!links.empty()){
+        rfd = open(fifopath, O_RDONLY | O_NONBLOCK);
+        wfd = open(fifopath, O_WRONLY | O_NONBLOCK);
+    }
+
+    if (sendstatusTCP(sTCP, USER_WATCH_ANSWER, OK) != FAIL){
+        struct pollfd fds[2];
+        fds[0].fd = sTCP->fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = rfd;
+        fds[1].events = POLLIN;
+        int nfds = (rfd == FAIL) ? 1 : 2;
+
+        time_t deadline = time(NULL) + WATCH_TIMEOUT;
+        while (true){
+            time_t left = deadline - time(NULL);
+            if (left <= 0){
+                break;
+            }
+            fds[0].revents = fds[1].revents = 0;
+            int ready = poll(fds, nfds, min((time_t) WATCH_HEARTBEAT, left) * 1000);
+            if (ready == FAIL){
+                if (errno == EINTR) continue;
+                break;
+            }
+            /* Nothing happened for a while: check the user is there */
+            if (ready == 0){
+                if (sendbytesTCP(sTCP, "\n", 1) == FAIL) break;
+                continue;
+            }
+            /* The user closed the session */
+            if (fds[0].revents){
+                break;
+            }
+            char notes[PIPE_BUF];
+            int nread = read(rfd, notes, sizeof(notes));
+            if ((nread > 0) && (sendbytesTCP(sTCP, notes, nread) == FAIL)){
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < links.size(); i++){
+        unlink(links[i].c_str());
+    }
+    if (rfd != FAIL) close(rfd);
+    if (wfd != FAIL) close(wfd);
+    leave_watchers();
+    disconnect(sTCP);
+}
+
+/**
+ * Joins the watch sessions open in the DS: each one has a WATCHERS
+ * entry, named after the client IP and the PID of the session. It
+ * fails if there are already MAX_WATCHES sessions, or MAX_WATCHES_IP
+ * sessions of the same client IP. Entries of sessions whose process
+ * is gone are removed on the way.
+ * 
+ * @return true if the session joined the watchers
+ * @return false if there are too many of them
+ */
+bool Server::join_watchers(){
+    if ((mkdir(WATCHERS, 0700) == FAIL) && (errno != EEXIST)){
+        return false;
+    }
+    DIR * d = opendir(WATCHERS);
+    if (!d){
+        return false;
+    }
+    flock(dirfd(d), LOCK_EX);
+
+    char ip[2 * sizeof(in_addr_t) + 1] = {'\0'};
+    sprintf(ip, "%08x", (unsigned) ntohl(sTCP->addr.sin_addr.s_addr));
+
+    int total = 0, same = 0;
+    struct dirent * dir;
+    while ((dir = readdir(d)) != NULL){
+        if (dir->d_name[0] == '.') continue;
+
+        char * pid = strchr(dir->d_name, '_');
+        if ((pid == NULL) || ((kill(atoi(pid + 1), 0) == FAIL) && (errno == ESRCH))){
+            string pathname = string(WATCHERS) + "/" + string(dir->d_name);
+            unlink(pathname.c_str());
+            continue;
+        }
+        total++;
+        if (!strncmp(dir->d_name, ip, pid - dir->d_name)){
+            same++;
+        }
+    }
+
+    bool joined = false;
+    if ((total < MAX_WATCHES) && (same < MAX_WATCHES_IP)){
+        char pathname[MAX_PATHNAME] = {'\0'};
+        sprintf(pathname, "%s/%s_%d", WATCHERS, ip, getpid());
+        int fd = open(pathname, O_WRONLY | O_CREAT, 0600);
+        if (fd != FAIL){
+            close(fd);
+            joined = true;
+        }
+    }
+    flock(dirfd(d), LOCK_UN);
+    closedir(d);
+    return joined;
+}
+
+/**
+ * Leaves the watch sessions open in the DS (see join_watchers).
+ */
+void Server::leave_watchers(){
+    char pathname[MAX_PATHNAME] = {'\0'};
+    sprintf(pathname, "%s/%08x_%d", WATCHERS, (unsigned) ntohl(sTCP->addr.sin_addr.s_addr), getpid());
+    unlink(pathname);
+}
+
+/**
+ * Sends a message of a group, given by GID and MID, in the format
+ * of a retrieve answer: " MID UID Tsize text[ / Fname Fsize data]".
+ * Without data, the attachment is only described (" / Fname Fsi-
+ * ze"), so it can be fetched later on its own (see attachment).
+ * 
+ * @param gid the GID of the group
+ * @param mid the MID of the message
+ * @param data whether the data of the attachment is sent
+ * @return int SUCCESS or FAIL
+ */
+int Server::send_message(char * gid, char * mid, bool data){
+    char path[MAX_PATHNAME] = {'\0'};
+
+    /* 1) UID */
+    sprintf(path, "GROUPS/%s/MSG/%s/A U T H O R.txt", gid, mid);
+    char userid[MAX_UID + 1] = {'\0'};
+    if(read_file(userid, path, MAX_UID) != MAX_UID){
+        return FAIL;
+    }
+    userid[MAX_UID] = '\0';
+
+    /* 2) Tsize and text */
+    char text[MAX_TEXT + 1] = {'\0'};
+    int tsize = 0;
+
+    sprintf(path, "GROUPS/%s/MSG/%s/T E X T.txt", gid, mid);
+    if((tsize = read_file(text, path, MAX_TEXT)) < 0){
+        return FAIL;
+    }
+    text[tsize] = '\0';
+
+    /* 3) MID UID Tsize text */
+    string buffer = " " + string(mid) + " " + string(userid) + " " + to_string(tsize) + " " + string(text);
+
+    /* Check if there's a file */
+    sprintf(path, "GROUPS/%s/MSG/%s/F N A M E.txt", gid, mid);
+    char fname[MAX_FNAME + 1] = {'\0'};
+
+    int n = read_file(fname, path, MAX_FNAME);
+    switch(n){
+        case FAIL:
+            return FAIL;
+        case NO_FILE:
+            return sendTCP(sTCP, buffer, buffer.size()) == FAIL ? FAIL : SUCCESS;
+    }
+
+    /* 4) " / Fname Fsize " */
+    sprintf(path, "GROUPS/%s/MSG/%s/%s", gid, mid, fname);
+    FILE * file = fopen(path, "r");
+    if (!file){
+        return FAIL;
+    }
+    fseek(file, 0, SEEK_END);
+    long fsize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    buffer += " / " + string(fname) + " " + to_string(fsize);
+    if (!data){
+        fclose(file);
+        return sendTCP(sTCP, buffer, buffer.length()) == FAIL ? FAIL : SUCCESS;
+    }
+    buffer += " ";
+    if(sendTCP(sTCP, buffer, buffer.length()) == FAIL){
+        fclose(file);
+        return FAIL;
+    }
+
+    /* 5) data */
+    int status = sendfileTCP(sTCP, file) == FAIL ? FAIL : SUCCESS;
+    fclose(file);
+    return status;
+}
+
+/**
+ * Sends the answer to a request that retrieves several messages:
+ * its header (e.g. "RRT OK N"), the messages, given by their MIDs,
+ * and the final "\n". The request is then finished, or the connec-
+ * tion closed if any of it couldn't be sent.
+ * 
+ * @param header the header of the answer
+ * @param gid the GID of the group of the messages
+ * @param mids the MIDs of the messages, in the order they are sent
+ * @param data whether the data of the attachments is sent
+ * @param gids the GID of each message, sent before it, if they 
+ * aren't all of the same group (feed); gid is then ignored
+ */
+void Server::send_messages(string header, char * gid, vector<int> & mids, bool data, vector<char *> * gids){
+    if (sendTCP(sTCP, header, header.size()) == FAIL){
+        disconnect(sTCP);
+        return;
+    }
+
+    for (size_t i = 0; i < mids.size(); i++){
+        char mid[MAX_MID + 1] = {'\0'};
+        sprintf(mid, "%04u", (unsigned) mids[i] % 10000);
+        if (gids){
+            gid = (*gids)[i];
+            string buffer = " " + string(gid);
+            if (sendTCP(sTCP, buffer, buffer.size()) == FAIL){
+                disconnect(sTCP);
+                return;
+            }
+        }
+        if (send_message(gid, mid, data) == FAIL){
+            disconnect(sTCP);
+            return;
+        }
+    }
+
+    if(sendTCP(sTCP, "\n", 1) == FAIL){
+        disconnect(sTCP);
+        return;
+    }
+    finish_request();
+}
+
+/**
+ * Executes the request corresponding to a retrieve command. With-
+ * out data (RTM), the attachments are only described.
+ * 
+ * @param data whether the data of the attachments is sent
+ */
+void Server::retrieve(bool data){
+    const char * answer = data ? USER_RETRIEVE_ANSWER : USER_RETRIEVE_META_ANSWER;
+
+    /** 
+     * 1. Receive and verify parameters: UID GID MID
+     */
+    /* Get UID */
+    char uid[MAX_UID + 1] = {'\0'};
+    int res1 = uid_receiveTCP(sTCP, uid, USER_RETRIEVE);
+    if (res1 == FAIL) return;
+    if (!res1){
+        sendstatusTCP(sTCP, answer, NOK);
+        disconnect(sTCP);
+        return;
+    }
+    uid[MAX_UID] = '\0'; 
+
+    /* Get GID */
+    char gid[MAX_GID + 1] = {'\0'};
+    int res2 = gid_receiveTCP(sTCP, gid, USER_RETRIEVE);
+    if (res2 == FAIL) return;
+    if (!res2){
+        sendstatusTCP(sTCP, answer, NOK);
+        disconnect(sTCP);
+        return;
+    }
+    gid[MAX_GID] = '\0'; 
+
+    /* Get MID */
+    char mid[MAX_MID + 1] = {'\0'};
+    int res3 = mid_receiveTCP(sTCP, mid, USER_RETRIEVE);
+    if (res3 == FAIL) return;
+    if (!res3){
+        sendstatusTCP(sTCP, answer, NOK);
+        disconnect(sTCP);
+        return;
+    }
+    mid[MAX_MID] = '\0'; 
+
+    retrieve_execute(uid, gid, mid, data);
+}
+
+/**
+ * Executes the request corresponding to a history command: a re-
+ * trieve of up to Count (up to MAX_PAGE) messages starting at a 
+ * cursor, which answers with the cursor of the next page, so a
+ * group can be read from its first message to its last one, page
+ * by page. A cursor is 4 digits; 0000 is the first page.
+ */
+void Server::retrieve_page(){
+    /* 1. Read the rest of the request: UID GID Cursor Count */
+    char uid[MAX_UID + 1] = {'\0'};
+    int res1 = uid_receiveTCP(sTCP, uid, USER_HISTORY);
+    if (res1 == FAIL) return;
+
+    char gid[MAX_GID + 1] = {'\0'};
+    int res2 = res1 ? gid_receiveTCP(sTCP, gid, USER_HISTORY) : 0;
+    if (res2 == FAIL) return;
+
+    /* The cursor after MID 9999 has 5 digits */
+    char cursor[MAX_MID + 3] = {'\0'};
+    char count[MAX_N + 2] = {'\0'};
+    char delimiter = '\0';
+    if (res2){
+        word_receiveTCP(sTCP, cursor, MAX_MID + 2);
+        word_receiveTCP(sTCP, count, MAX_N + 1, &delimiter);
+    }
+    if (!res2 || (strlen(cursor) < MAX_MID) || (strlen(cursor) > MAX_MID + 1) || !all_of_class(cursor, CLASS_DIGIT) || (delimiter != '\n')
+        || !parse_count(count) || (atoi(count) > MAX_PAGE)){
+        sendstatusTCP(sTCP, USER_RETRIEVE_PAGE_ANSWER, NOK);
+        disconnect(sTCP);
+        return;
+    }
+
+    if (m_verbose) print_verbose(sTCP, USER_HISTORY, string(uid), string(gid));
+
+    /* 2. Conditions for valid history verification: the user needs
+    to exist, be logged in and be subscribed to the group */
+    if ((validate_user(uid) != VALID) || (validate_group(gid, uid) != VALID)){
+        sendstatusTCP(sTCP, USER_RETRIEVE_PAGE_ANSWER, NOK);
+        finish_request();
+        return;
+    }
+
+    /**
+     * 3. Execute request
+     * Format: RRP OK Cursor N[ MID UID Tsize text[ / Fname Fsize 
+     * data]]* or RRP EOF (no messages from the cursor on)
+     */
+    vector<int> mids;
+    int next = list_messages(gid, atoi(cursor), atoi(count), mids);
+    if (mids.empty()){
+        sendstatusTCP(sTCP, USER_RETRIEVE_PAGE_ANSWER, EOF_);
+        finish_request();
+        return;
+    }
+
+    char next_cursor[MAX_STRING] = {'\0'};
+    sprintf(next_cursor, "%04d", next);
+    string header = string(USER_RETRIEVE_PAGE_ANSWER) + " " + string(OK) + " " + string(next_cursor) + " " + to_string(mids.size());
+    send_messages(header, gid, mids, true);
+}
+
+/**
+ * Executes the request corresponding to a tail command: a retrie-
+ * ve of the last N (up to 20) messages of a group, so the user 
+ * doesn't need to know the MID of its last message.
+ */
+void Server::tail(){
+    /* 1. Read the rest of the request: UID GID N */
+    char uid[MAX_UID + 1] = {'\0'};
+    int res1 = uid_receiveTCP(sTCP, uid, USER_TAIL);
+    if (res1 == FAIL) return;
+
+    char gid[MAX_GID + 1] = {'\0'};
+    int res2 = res1 ? gid_receiveTCP(sTCP, gid, USER_TAIL) : 0;
+    if (res2 == FAIL) return;
+
+    char count[MAX_N + 2] = {'\0'};
+    char delimiter = '\0';
+    if (res2){
+        word_receiveTCP(sTCP, count, MAX_N + 1, &delimiter);
+    }
+    if (!res2 || (delimiter != '\n') || !parse_count(count) || (atoi(count) > MAX_WINDOW)){
+        sendstatusTCP(sTCP, USER_TAIL_ANSWER, NOK);
+        disconnect(sTCP);
+        return;
+    }
+
+    if (m_verbose) print_verbose(sTCP, USER_TAIL, string(uid), string(gid));
+
+    /* 2. Conditions for valid tail verification: the user needs to
+    exist, be logged in and be subscribed to the group */
+    if ((validate_user(uid) != VALID) || (validate_group(gid, uid) != VALID)){
+        sendstatusTCP(sTCP, USER_TAIL_ANSWER, NOK);
+        finish_request();
+        return;
+    }
+
+    /**
+     * 3. Execute request
+     * Format: RRL OK N[ MID UID Tsize text[ / Fname Fsize data]]*
+     * or RRL EOF (the group has no messages)
+     */
+    vector<int> mids;
+    list_latest(gid, atoi(count), mids);
+    if (mids.empty()){
+        sendstatusTCP(sTCP, USER_TAIL_ANSWER, EOF_);
+        finish_request();
+        return;
+    }
+
+    string header = string(USER_TAIL_ANSWER) + " " + string(OK) + " " + to_string(mids.size());
+    send_messages(header, gid, mids, true);
+}
+
+/**
+ * Executes a retrieve request whose parameters were already recei-
+ * ved, either from a text or a framed (v2) request.
+ * 
+ * @param uid the UID of the user
+ * @param gid the GID of the group
+ * @param mid the MID of the first message
+ * @param data whether the data of the attachments is sent
+ */
+void Server::retrieve_execute(char * uid, char * gid, char * mid, bool data){
+    const char * answer = data ? USER_RETRIEVE_ANSWER : USER_RETRIEVE_META_ANSWER;
+    if (m_verbose) print_verbose(sTCP, USER_RETRIEVE, string(uid), string(gid));
+
+    /* 2. Conditions for valid retrieve verification 
+     * Steps:
+     * a) validate user (exists and is logged in)
+     * b) valid gid (exists and the user subscribed to the group)
+     */
+    if(validate_user(uid) != VALID){
+        sendstatusTCP(sTCP, answer, NOK);
+        finish_request();
+        return;
+    }
+    
+    if(validate_group(gid, uid) != VALID){
+        sendstatusTCP(sTCP, answer, NOK);
+        finish_request();
+        return;
+    }
+
+    /**
+     * 3. Execute request
+     * Steps:
+     *  a) Get and send N (number of messages retrieved)
+     *  b) For each message:
+     *      1) Get MID
+     *      2) Get UID
+     *      3) Get Tsize and text
+     *      4) Send MID UID Tsize text
+     *      5) Get and send Fname Fsize
+     *      6) Send data
+     */ 
+    /* a) Calculate and send N: incomplete messages are omitted */
+    vector<int> mids;
+    list_messages(gid, stoi(mid), MAX_WINDOW, mids);
+    int N = mids.size();
+
+    if (N <= 0){
+        sendstatusTCP(sTCP, answer, EOF_);
+        finish_request();
+        return;
+    }
+
+    /* b) Send each message */
+    string header = string(answer) + " " + string(OK) + " " + to_string(N);
+    send_messages(header, gid, mids, data);
+}
+
+/**
+ * Executes the request corresponding to an attachment command.
+ * The DS server sends the file attached to a message of a group,
+ * given by GID and MID, on its own (e.g. after a retrieve without
+ * the attachments' data). A byte range of it (ATR) can be asked
+ * for instead, so a broken transfer is resumed where it stopped.
+ * 
+ * @param range whether a byte range (Offset Length) is asked for
+ */
+void Server::attachment(bool range){
+    const char * answer = range ? USER_RANGE_ANSWER : USER_ATTACHMENT_ANSWER;
+
+    /* 1. Read the rest of the request: UID GID MID[ Offset Length] */
+    char uid[MAX_UID + 1] = {'\0'};
+    int res1 = uid_receiveTCP(sTCP, uid, USER_ATTACHMENT);
+    if (res1 == FAIL) return;
+
+    char gid[MAX_GID + 1] = {'\0'};
+    int res2 = res1 ? gid_receiveTCP(sTCP, gid, USER_ATTACHMENT) : 0;
+    if (res2 == FAIL) return;
+
+    char mid[MAX_MID + 1] = {'\0'};
+    int res3 = res2 ? mid_receiveTCP(sTCP, mid, USER_ATTACHMENT) : 0;
+    if (res3 == FAIL) return;
+
+    /* A Length of 0 asks for the rest of the file */
+    char offset[MAX_FSIZE + 2] = {'\0'};
+    char length[MAX_FSIZE + 2] = {'\0'};
+    if (range && res3){
+        char delimiter = '\0';
+        res3 = fsize_receiveTCP(sTCP, offset, USER_ATTACHMENT);
+        if (res3 == FAIL) return;
+        word_receiveTCP(sTCP, length, MAX_FSIZE + 1, &delimiter);
+        res3 = res3 && parse_fsize(length) && (delimiter == '\n');
+    }
+    if (!res3){
+        sendstatusTCP(sTCP, answer, NOK);
+        disconnect(sTCP);
+        return;
+    }
+
+    if (m_verbose) print_verbose(sTCP, USER_ATTACHMENT, string(uid), string(gid));
+
+    /* 2. Conditions for valid attachment verification: the user 
+    needs to exist, be logged in and be subscribed to the group */
+    if ((validate_user(uid) != VALID) || (validate_group(gid, uid) != VALID)){
+        sendstatusTCP(sTCP, answer, NOK);
+        finish_request();
+        return;
+    }
+
+    /**
+     * 3. Execute request
+     * Format: RAT OK Fname Fsize data or RAR OK Fname Fsize Length 
+     * data, where data is the range; RAT/RAR NOK if the message has
+     * no attachment, and RAR E_RANGE if the range starts past its 
+     * end (so the user knows its partial file is no good)
+     */
+    char path[MAX_PATHNAME] = {'\0'};
+    sprintf(path, "GROUPS/%s/MSG/%s/F N A M E.txt", gid, mid);
+    char fname[MAX_FNAME + 1] = {'\0'};
+    int n = read_file(fname, path, MAX_FNAME);
+
+    int fd = FAIL;
+    if (n > 0){
+        fname[n] = '\0';
+        sprintf(path, "GROUPS/%s/MSG/%s/%s", gid, mid, fname);
+        fd = open(path, O_RDONLY);
+    }
+    struct stat info;
+    if ((fd == FAIL) || (fstat(fd, &info) == FAIL)){
+        if (fd != FAIL) close(fd);
+        sendstatusTCP(sTCP, answer, NOK);
+        finish_request();
+        return;
+    }
+    if (atol(offset) > info.st_size){
+        close(fd);
+        sendstatusTCP(sTCP, answer, E_RANGE);
+        finish_request();
+        return;
+    }
+
+    long first = atol(offset);
+    long count = info.st_size - first;
+    if (atol(length) > 0){
+        count = min(count, atol(length));
+    }
+
+    string buffer = string(answer) + " " + string(OK) + " " + string(fname) + " " + to_string(info.st_size) + " ";
+    if (range){
+        buffer += to_string(count) + " ";
+    }
+    if ((sendTCP(sTCP, buffer, buffer.size()) == FAIL) || (sendrangeTCP(sTCP, fd, first, count) == FAIL)
+        || (sendTCP(sTCP, "\n", 1) == FAIL)){
+        close(fd);
+        disconnect(sTCP);
+        return;
+    }
+    close(fd);
+    finish_request();
+}
+
+/**
+ * Executes the request corresponding to a feed command. The DS
+ * server sends the latest N messages of all the groups the user,
+ * given by its UID, is subscribed to, merged by the order they
+ * were posted in (their sequence number, see publish).
+ * The index of each group already keeps its messages in that or-
+ * der, so only the newest one of each group needs to be compared:
+ * a heap keeps the next message of every group, read from the end
+ * of its index, and the newest of them is taken N times (a k-way
+ * merge). Only N messages and one more per group are read.
+ */
+void Server::feed(){
+    /* 1. Read the rest of the request: UID N */
+    char uid[MAX_UID + 1] = {'\0'};
+    int res = uid_receiveTCP(sTCP, uid, USER_FEED);
+    if (res == FAIL) return;
+    if (!res){
+        sendstatusTCP(sTCP, USER_FEED_ANSWER, NOK);
+        disconnect(sTCP);
+        return;
+    }
+    uid[MAX_UID] = '\0';
+
+    char count[MAX_N + 2] = {'\0'};
+    char delimiter = '\0';
+    word_receiveTCP(sTCP, count, MAX_N + 1, &delimiter);
+    if ((delimiter != '\n') || !parse_count(count) || (atoi(count) > MAX_FEED)){
+        sendstatusTCP(sTCP, USER_FEED_ANSWER, NOK);
+        disconnect(sTCP);
+        return;
+    }
+    int N = atoi(count);
+
+    if (m_verbose) print_verbose(sTCP, USER_FEED, string(uid), "");
+
+    /* 2. Conditions for valid feed verification: the user needs 
+    to exist and be logged in */
+    if (validate_user(uid) != VALID){
+        sendstatusTCP(sTCP, USER_FEED_ANSWER, NOK);
+        finish_request();
+        return;
+    }
+
+    /**
+     * 3. Execute request
+     * a) Push the newest message of each subscribed group
+     * b) Pop the newest message N times, pushing the previous 
+     * message of its group each time
+     * c) Send them, the oldest first
+     * Format: RFD OK N[ GID MID UID Tsize text[ / Fname Fsize data]]*
+     */
+    GROUPLIST * groups = (GROUPLIST * )malloc(sizeof(GROUPLIST));
+    init_groups_dir(groups);
+    list_groups_dir(groups, uid);
+
+    /* {sequence number, group, MID} */
+    typedef struct { long seq; int group; int mid; } ENTRY;
+    auto older = [](const ENTRY & a, const ENTRY & b){
+        return (a.seq != b.seq) ? (a.seq < b.seq) : (a.group < b.group);
+    };
+
+    /* The index of each group and how many of its records are 
+    still to be read, from the end */
+    vector<int> indexes(MAX_NGROUPS, FAIL);
+    vector<long> left(MAX_NGROUPS, 0);
+    for (int i = 0; i < MAX_NGROUPS; i++){
+        char * gid = groups->group_no[i];
+        if (gid[0] == '\0') continue;
+        char indexpath[MAX_PATHNAME] = {'\0'};
+        sprintf(indexpath, "GROUPS/%s/%s_index.txt", gid, gid);
+        indexes[i] = open(indexpath, O_RDONLY);
+        if (indexes[i] != FAIL){
+            left[i] = lseek(indexes[i], 0, SEEK_END) / INDEX_RECORD;
+        }
+    }
+
+    /* Pushes the newest message of a group not yet in the feed */
+    priority_queue<ENTRY, vector<ENTRY>, decltype(older)> heap(older);
+    auto push = [&](int group){
+        char record[INDEX_RECORD + 1] = {'\0'};
+        while (left[group] > 0){
+            left[group]--;
+            if (pread(indexes[group], record, INDEX_RECORD, left[group] * INDEX_RECORD) != INDEX_RECORD) continue;
+            record[MAX_MID] = '\0';
+            if (!parse_mid(record)) continue;
+
+            char path[MAX_PATHNAME] = {'\0'};
+            sprintf(path, "GROUPS/%s/MSG/%s/S E Q.txt", groups->group_no[group], record);
+            heap.push({read_version(path), group, atoi(record)});
+            return;
+        }
+    };
+
+    for (int i = 0; i < MAX_NGROUPS; i++){
+        push(i);
+    }
+
+    vector<ENTRY> latest;
+    while (((int) latest.size() < N) && !heap.empty()){
+        ENTRY entry = heap.top();
+        heap.pop();
+        latest.push_back(entry);
+        push(entry.group);
+    }
+
+    for (int i = 0; i < MAX_NGROUPS; i++){
+        if (indexes[i] != FAIL) close(indexes[i]);
+    }
+
+    if (latest.empty()){
+        free(groups);
+        sendstatusTCP(sTCP, USER_FEED_ANSWER, EOF_);
+        finish_request();
+        return;
+    }
+
+    vector<char *> gids;
+    vector<int> mids;
+    for (int i = latest.size() - 1; i >= 0; i--){
+        gids.push_back(groups->group_no[latest[i].group]);
+        mids.push_back(latest[i].mid);
+    }
+
+    string header = string(USER_FEED_ANSWER) + " " + string(OK) + " " + to_string(latest.size());
+    send_messages(header, NULL, mids, true, &gids);
+    free(groups);
 }
 
 //::::::::::::::::::::::::::: MAIN :::::::::::::::::::::::::::://
@@ -20,6 +20,15 @@
 #include <dirent.h>
 #include <stdio.h>
 #include <algorithm>
+#include <sys/wait.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <sys/time.h>
+#include <sys/file.h>
+#include <poll.h>
+#include <queue>
 
 #include "../utils.hpp"
 #include "../constant.hpp"
@@ -36,13 +45,45 @@ typedef struct grouplist {
     char group_no[MAX_NGROUPS][MAX_GID + 1]; /* The GID of each group */
     char group_name[MAX_NGROUPS][MAX_GNAME + 1]; /* The GName of each group */
     char group_mid[MAX_NGROUPS][MAX_MID + 1]; /* The MID of the last message of each group */
+    long group_version[MAX_NGROUPS]; /* The catalog version of the last change of each group */
 } GROUPLIST;
 
+/* The inbox of a user (-f): a ring of its last INBOX_SIZE notifi-
+cations, kept in USERS/UID/UID_inbox.txt */
+typedef struct inbox {
+    int64_t first; /* The sequence number of the oldest notification */
+    int32_t head; /* The index of the oldest notification */
+    int32_t count; /* The number of notifications */
+    char notes[INBOX_SIZE][MAX_NOTE]; /* Each one is "GID MID\n" */
+} INBOX;
+
+/* Token bucket limiting the requests of a single client IP */
+typedef struct bucket {
+    double tokens; /* The requests the client can still make right away */
+    struct timeval last; /* When the tokens were last refilled */
+} BUCKET;
+
 class Server{
     bool m_verbose;
     string m_dsport;
     SOCKET * socketUDP, * socketTCP, * sTCP;
 
+    int m_nworkers; /* Number of pre-forked TCP workers (0: fork per connection) */
+    vector<pid_t> m_workers; /* The PID of each running TCP worker */
+
+    bool m_persistent; /* The TCP session carries several requests (SES) */
+    bool m_keep; /* The last TCP request left the session open */
+    bool m_framed; /* The current TCP request uses the binary framing (v2) */
+    bool m_fanout; /* Each post is also delivered to the inbox of every subscriber (-f) */
+
+    int m_sessions; /* Number of open TCP sessions (fork per connection) */
+    map<in_addr_t, BUCKET> m_udp_buckets, m_tcp_buckets;
+    long m_shed_udp, m_shed_tcp_rate, m_shed_tcp_full; /* Rejected requests */
+
+    GROUPLIST * m_catalog; /* The list of all groups, as of m_catalog_version */
+    long m_catalog_version; /* The catalog version of m_catalog (-1: not listed yet) */
+    string m_groups_answer; /* The GLS answer, serialized from m_catalog */
+
 public:
     Server(int argc, char** argv);
 
@@ -50,6 +91,7 @@ private:
     //:::::::::::::: INITIALIZATION/TERMINATION ::::::::::::::://
     void parse_arguments(int argc, char** argv);
     void handle_request(char * request);
+    void handle_tcp_request(char * request);
     void terminate();
 
     //::::::::::::::::::::: COMMUNICATION ::::::::::::::::::::://
@@ -57,6 +99,24 @@ private:
     void connectUDP(string port);
     void connectTCP(string port);
     void receive_request();
+    void accept_connections();
+    void serve_datagrams();
+    bool pending(int fd);
+    void handle_connection(int connfd, struct sockaddr_in cliaddr);
+    bool serve_tcp_request();
+    void serve_frame(unsigned char * header);
+    void finish_request();
+
+    //:::::::::::::::::::::: WORKER POOL :::::::::::::::::::::::://
+    pid_t spawn_worker();
+    void run_worker();
+    void reap_children();
+
+    //::::::::::::::::::: ADMISSION CONTROL ::::::::::::::::::::://
+    bool admit(map<in_addr_t, BUCKET> & buckets, in_addr_t ip, double rate, double burst);
+    void prune_buckets(map<in_addr_t, BUCKET> & buckets, double rate, double burst);
+    void reject_connection(int connfd);
+    void print_stats();
 
     //:::::::::::::::: CONDITIONS VALIDATION :::::::::::::::::://
     int validate_user(const char * uid);
@@ -71,9 +131,28 @@ private:
     //::::::::::::::::::::: AUXILIARIES ::::::::::::::::::::::://
     void init_groups_dir(GROUPLIST * groups);
     int list_groups_dir(GROUPLIST * list, const char * uid);
+    int list_subscribers(char * gid, vector<string> & uids);
+    string serialize_groups(GROUPLIST * groups, long since, int first, int count);
+    long catalog_version();
+    long stamp_version(const char * pathname, const char * also = NULL);
+    long read_version(const char * pathname);
+    GROUPLIST * cached_catalog(long * version);
+    void stamp_groups();
+    void index_messages(char * gid, char * indexpath);
     int count_mid(char * gid);
+    int list_messages(char * gid, int first, int count, vector<int> & mids);
+    void list_latest(char * gid, int count, vector<int> & mids);
+    int claim_mid(char * gid, char * mid);
+    void abandon_mid(char * gid, char * mid, const char * fname);
+    int claim_upload(char * id);
+    long upload_received(const char * uid, const char * id, long * fsize);
+    int sweep_uploads(const char * uid);
+    void discard_upload(const char * id);
+    int send_message(char * gid, char * mid, bool data);
+    void send_messages(string header, char * gid, vector<int> & mids, bool data, vector<char *> * gids = NULL);
     int count_gid();
     int read_file(char * data, char * pathname, int bytes);
+    int write_file(const char * data, char * pathname);
     void print_verbose(SOCKET * s, string request, string uid, string gid);
     string get_clientIPv4(SOCKET * s);
     string get_clientport(SOCKET * s);
@@ -83,13 +162,32 @@ private:
     void unregister(string uid, string pass);
     void login(string uid, string pass);
     void logout(string uid, string pass);
-    void groups();
+    void groups(const char * answer, bool delta, long since, int first, int count);
     void subscribe(string uid, string gid, string gname);
     void unsubscribe(string uid, string gid);
-    void my_groups(string uid);
+    void my_groups(string uid, const char * answer, bool delta, long since, int first, int count);
     void ulist();
+    void ulist_execute(char * gid);
     void post();
-    void retrieve();
+    void post_execute(char * uid, char * gid, char * text, char * fname, long fsize);
+    void upload_open();
+    void upload_chunk();
+    void upload_finish(bool commit);
+    void retrieve(bool data);
+    void retrieve_execute(char * uid, char * gid, char * mid, bool data);
+    void retrieve_page();
+    void tail();
+    void attachment(bool range);
+    void watch();
+    void watch_session(char * uid);
+    bool join_watchers();
+    void leave_watchers();
+    void publish(char * gid, char * mid);
+    void notify_watchers(char * gid, char * mid);
+    void fan_out(char * gid, char * mid);
+    void inbox(string uid, long ack);
+    void read_inbox(int fd, INBOX * box);
+    void feed();
 };
 
 
@@ -0,0 +1,133 @@
+#include "../utils.hpp"
+
+/**
+ * Differential test of parsers::all_of_class: random strings, 
+ * made of characters of a set of classes with, sometimes, one from
+ * outside it, are checked by it and by a loop over a class table,
+ * which must agree. The Makefile builds it once per path of 
+ * all_of_class (SSE2 and scalar), with utils.cpp built the same 
+ * way.
+ */
+
+#define ROUNDS 200000
+#define MAX_LENGTH 48
+#define SEED 12
+
+/* The classes of each of the 256 characters (CLASS_* bits), as 
+described in constant.hpp */
+static unsigned char classes_of[256];
+
+/**
+ * Builds the class table, byte by byte.
+ */
+static void make_table(){
+    for (int c = 0; c < 256; c++){
+        unsigned char classes = 0;
+        if ((c >= '0') && (c <= '9')){
+            classes |= CLASS_DIGIT | CLASS_NAME | CLASS_FNAME;
+        }
+        if (((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z'))){
+            classes |= CLASS_LETTER | CLASS_NAME | CLASS_FNAME;
+        }
+        if ((c == '-') || (c == '_')){
+            classes |= CLASS_NAME | CLASS_FNAME;
+        }
+        if (c == '.'){
+            classes |= CLASS_FNAME;
+        }
+        classes_of[c] = classes;
+    }
+}
+
+/**
+ * Checks if every character of a string belongs to a set of clas-
+ * ses, byte by byte.
+ * 
+ * @param data the string
+ * @param n its length
+ * @param classes the classes (CLASS_* bits)
+ * @return true if they all belong to one of the classes
+ * @return false if they don't
+ */
+static bool reference(const char * data, int n, unsigned char classes){
+    for (int i = 0; i < n; i++){
+        if (!(classes_of[(unsigned char) data[i]] & classes)){
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Gets a random character of a set of classes.
+ * 
+ * @param classes the classes (CLASS_* bits)
+ * @return char the character
+ */
+static char random_member(unsigned char classes){
+    int c;
+    do {
+        c = rand() % 256;
+    } while (!(classes_of[c] & classes));
+    return (char) c;
+}
+
+/**
+ * Gets a random character outside a set of classes: often one 
+ * next to a range of them (e.g. '/', ':', '@', '['), or a byte
+ * above 0x7F, which is negative as a signed char.
+ * 
+ * @param classes the classes (CLASS_* bits)
+ * @return char the character
+ */
+static char random_outsider(unsigned char classes){
+    static const char edges[] = {'/', ':', '@', '[', '`', '{', ' ', '\n', '\0', '.', '-', '_', '0', 'A', 'z'};
+    int c;
+    do {
+        switch (rand() % 3){
+            case 0: c = (unsigned char) edges[rand() % sizeof(edges)]; break;
+            case 1: c = 0x80 + rand() % 128; break;
+            default: c = rand() % 256; break;
+        }
+    } while (classes_of[c] & classes);
+    return (char) c;
+}
+
+int main(){
+#if defined(__SSE2__)
+    const char * path = "SSE2";
+#else
+    const char * path = "scalar";
+#endif
+    srand(SEED);
+    make_table();
+
+    /* Strings start at every offset from an aligned buffer, so the
+    unaligned loads are tested too */
+    alignas(16) char buffer[MAX_LENGTH + 16];
+    for (int round = 0; round < ROUNDS; round++){
+        unsigned char classes = 1 + rand() % 15;
+        int offset = rand() % 16;
+        int n = rand() % (MAX_LENGTH + 1);
+        char * data = buffer + offset;
+        for (int i = 0; i < n; i++){
+            data[i] = random_member(classes);
+        }
+
+        /* Half the strings have a character from outside */
+        if ((n > 0) && (rand() % 2)){
+            data[rand() % n] = random_outsider(classes);
+        }
+
+        bool expected = reference(data, n, classes);
+        bool got = parsers::all_of_class(string_view(data, n), classes);
+        if (got != expected){
+            fprintf(stderr, "all_of_class (%s): got %d instead of %d (n = %d, offset = %d, classes = 0x%02x, round %d).\n",
+                path, got, expected, n, offset, classes, round);
+            return 1;
+        }
+    }
+
+    fprintf(stdout, "all_of_class (%s): %d strings OK.\n", path, ROUNDS);
+    return 0;
+}
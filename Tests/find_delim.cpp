@@ -0,0 +1,90 @@
+#include "../utils.hpp"
+
+/**
+ * Differential test of auxiliaries::find_delim: random blocks of 
+ * bytes, with delimiters (' ' or '\n') at random positions, or 
+ * none, are searched by it and by a plain loop, which must agree.
+ * The Makefile builds it once per path of find_delim (AVX2, SSE2
+ * and scalar), with utils.cpp built the same way.
+ */
+
+#define ROUNDS 200000
+#define MAX_BLOCK 300
+#define SEED 12
+
+/**
+ * Finds the first ' ' or '\n' in a block of bytes, byte by byte.
+ * 
+ * @param data the bytes
+ * @param n the number of bytes
+ * @return int the position of the delimiter, or n if there's none
+ */
+static int reference(const char * data, int n){
+    for (int i = 0; i < n; i++){
+        if ((data[i] == ' ') || (data[i] == '\n')){
+            return i;
+        }
+    }
+    return n;
+}
+
+/**
+ * Gets a random byte which isn't a delimiter. Bytes above 0x7F
+ * are included, since they're negative as signed chars.
+ * 
+ * @return char the byte
+ */
+static char random_byte(){
+    char c;
+    do {
+        c = (char) (rand() % 256);
+    } while ((c == ' ') || (c == '\n'));
+    return c;
+}
+
+int main(){
+#if defined(__AVX2__)
+    const char * path = "AVX2";
+    if (!__builtin_cpu_supports("avx2")){
+        fprintf(stdout, "find_delim (%s): skipped, not supported by this CPU.\n", path);
+        return 0;
+    }
+#elif defined(__SSE2__)
+    const char * path = "SSE2";
+#else
+    const char * path = "scalar";
+#endif
+    srand(SEED);
+
+    /* Blocks start at every offset from an aligned buffer, so the
+    unaligned loads are tested too */
+    alignas(32) char buffer[MAX_BLOCK + 32];
+    for (int round = 0; round < ROUNDS; round++){
+        int offset = rand() % 32;
+        int n = rand() % (MAX_BLOCK + 1);
+        char * data = buffer + offset;
+        for (int i = 0; i < n; i++){
+            data[i] = random_byte();
+        }
+
+        /* Up to 3 delimiters; some blocks have none */
+        int ndelims = rand() % 4;
+        for (int d = 0; (d < ndelims) && (n > 0); d++){
+            data[rand() % n] = (rand() % 2) ? ' ' : '\n';
+        }
+
+        /* A delimiter right after the block must not be found */
+        data[n] = ' ';
+
+        int expected = reference(data, n);
+        int got = auxiliaries::find_delim(data, n);
+        if (got != expected){
+            fprintf(stderr, "find_delim (%s): got %d instead of %d (n = %d, offset = %d, round %d).\n",
+                path, got, expected, n, offset, round);
+            return 1;
+        }
+    }
+
+    fprintf(stdout, "find_delim (%s): %d blocks OK.\n", path, ROUNDS);
+    return 0;
+}
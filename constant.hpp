@@ -11,6 +11,9 @@
 
 #define USERS "USERS"
 #define GROUPS "GROUPS"
+#define WATCH "WATCH"
+#define UPLOADS "UPLOADS"
+#define WATCHERS "WATCHERS"
 
 #define PASS "pass"
 #define LOGIN "login"
@@ -38,6 +41,7 @@
 //::::::::::::::::::::::::::: SIZES ::::::::::::::::::::::::::://
 #define MAX_MESSAGE 256
 #define MAX_STRING_TCP 512
+#define RECV_BUFFER 4096 //bytes buffered per TCP socket
 #define MAX_HEAD_TCP 4
 #define MAX_STRING_UDP 4096
 #define MAX_REQUEST_UDP 128
@@ -57,7 +61,66 @@
 #define MAX_NAME 32
 #define MAX_ID 16
 #define MAX_NGROUPS 99
+#define MAX_MESSAGES 9999
 #define MAX_INPUT_SIZE 512
+#define MAX_WORKERS 256
+#define MAX_NOTE 8 //len("GID MID\n"), a notification of a new message
+#define INBOX_SIZE 64 //notifications kept per user (-f), the oldest are dropped first
+#define LISTEN_BACKLOG SOMAXCONN
+#define MAX_ACCEPT_BATCH 64
+#define MAX_UDP_BATCH 64
+#define MAX_FIELDS 4 //fields of a UDP request
+#define MAX_FIELD 24 //len(GName), the longest field
+#define MAX_TOKENS (3 * MAX_NGROUPS + 4) //words of a UDP answer: RGD Version Since N[ GID GName MID]*
+#define MAX_VERSION 10 //digits of a catalog version
+#define GROUPS_PAGE 40 //groups per paged answer: 40 * 33 + 8 bytes fit one unfragmented datagram
+#define MAX_FEED 20 //messages per feed answer, like a retrieve
+#define INDEX_RECORD 5 //bytes of a record of a group index ("MID\n")
+#define MAX_WINDOW 20 //messages per retrieve answer
+#define MAX_PAGE 50 //messages per paged retrieve answer
+#define MAX_UPLOAD_ID 8 //digits of an upload ID
+#define UPLOAD_CHUNK 65536 //bytes per chunk of an upload (-u)
+#define MAX_UPLOADS 4 //open uploads, per user
+#define UPLOAD_TTL 86400 //seconds an idle upload is kept
+
+//::::::::::::::::::::::::: DEADLINES :::::::::::::::::::::::::://
+#define SESSION_TIMEOUT 30 //seconds per TCP read/write
+#define REQUEST_TIMEOUT 60 //seconds to receive a whole request, but file data
+#define MIN_TRANSFER_RATE 1024 //bytes per second
+#define TRANSFER_GRACE 10 //seconds before checking the rate
+#define WATCH_HEARTBEAT 30 //seconds of a quiet watch before a heartbeat
+#define WATCH_TIMEOUT 3600 //seconds a watch may last
+
+#define LANE_LATENCY 0 //requests and short replies
+#define LANE_BULK 1 //attachment data
+
+//:::::::::::::::::::::: ADMISSION CONTROL ::::::::::::::::::::://
+#define MAX_SESSIONS 128 //concurrent TCP sessions
+#define MAX_BUCKETS 4096 //client IPs tracked at once
+#define UDP_RATE 20 //requests per second, per client IP
+#define UDP_BURST 40
+#define TCP_RATE 5 //sessions per second, per client IP
+#define TCP_BURST 20
+#define MAX_WATCHES 64 //concurrent watch sessions
+#define MAX_WATCHES_IP 4 //concurrent watch sessions, per client IP
+
+//::::::::::::::::::::: CHARACTER CLASSES :::::::::::::::::::::://
+#define CLASS_DIGIT 0x01 //'0'-'9'
+#define CLASS_LETTER 0x02 //'A'-'Z', 'a'-'z'
+#define CLASS_NAME 0x04 //digits, letters, '-' and '_' (GName)
+#define CLASS_FNAME 0x08 //name characters and '.' (Fname)
+
+//:::::::::::::::::::: BINARY FRAMING (V2) :::::::::::::::::::://
+#define FRAME_MAGIC 0xD2 //first byte of a framed request; text ones start with a letter
+#define FRAME_HEADER 8 //magic, opcode, flags, reserved, payload length (4 bytes)
+#define FRAME_ULIST 1 //payload: GID
+#define FRAME_POST 2 //payload: UID GID Tsize(2) Fname Fsize(4) text data
+#define FRAME_RETRIEVE 3 //payload: UID GID MID
+#define FRAME_KEEP 0x01 //flag: keep the session open afterwards (like SES)
+#define FRAME_META 0x02 //flag: retrieve without the attachments' data (like RTM)
+#define FRAME_ULIST_SIZE MAX_GID
+#define FRAME_POST_SIZE (MAX_UID + MAX_GID + 2 + MAX_FNAME + 4) //without text and data
+#define FRAME_RETRIEVE_SIZE (MAX_UID + MAX_GID + MAX_MID)
 
 //::::::::::::::::::::::::::: INPUT ::::::::::::::::::::::::::://
 #define USER_REG "reg" //reg
@@ -85,6 +148,18 @@
 #define USER_POST "post" //post
 #define USER_RETRIEVE "retrieve" //retrieve
 #define USER_RETRIEVE_ALT "r" //retrieve
+#define USER_WATCH "watch" //watch
+#define USER_WATCH_ALT "wt" //watch
+#define USER_INBOX "inbox" //inbox
+#define USER_INBOX_ALT "ib" //inbox
+#define USER_FEED "feed" //feed
+#define USER_FEED_ALT "fd" //feed
+#define USER_HISTORY "history" //history
+#define USER_HISTORY_ALT "hs" //history
+#define USER_TAIL "tail" //tail
+#define USER_TAIL_ALT "tl" //tail
+#define USER_ATTACHMENT "attachment" //attachment
+#define USER_ATTACHMENT_ALT "at" //attachment
 
 //:::::::::::::::::::::::::: REQUEST :::::::::::::::::::::::::://
 #define USER_REG_REQUEST "REG" //reg
@@ -95,9 +170,26 @@
 #define USER_SUBSCRIBE_REQUEST "GSR" //subscribe
 #define USER_UNSUBSCRIBE_REQUEST "GUR" //unsubscribe
 #define USER_MY_GROUPS_REQUEST "GLM" //my_groups
+#define USER_GROUPS_PAGE_REQUEST "GLP" //groups, one page at a time
+#define USER_MY_GROUPS_PAGE_REQUEST "GMP" //my_groups, one page at a time
+#define USER_GROUPS_DELTA_REQUEST "GLD" //groups, changed since a version
+#define USER_MY_GROUPS_DELTA_REQUEST "GMD" //my_groups, changed since a version
+#define USER_INBOX_REQUEST "INB" //inbox
 #define USER_ULIST_REQUEST "ULS" //ulist
 #define USER_POST_REQUEST "PST" //post
 #define USER_RETRIEVE_REQUEST "RTV" //retrieve
+#define USER_RETRIEVE_META_REQUEST "RTM" //retrieve, without the attachments' data (-m)
+#define USER_ATTACHMENT_REQUEST "ATT" //attachment
+#define USER_RANGE_REQUEST "ATR" //attachment, a byte range of it
+#define USER_UPLOAD_OPEN_REQUEST "UPO" //post, opening an upload (-u)
+#define USER_UPLOAD_CHUNK_REQUEST "UPC" //post, a chunk of an upload (-u)
+#define USER_UPLOAD_QUERY_REQUEST "UPQ" //post, the bytes of an upload received (-u)
+#define USER_UPLOAD_COMMIT_REQUEST "UPF" //post, committing an upload (-u)
+#define USER_SESSION_REQUEST "SES" //persistent TCP session
+#define USER_WATCH_REQUEST "WTC" //watch
+#define USER_FEED_REQUEST "FED" //feed
+#define USER_RETRIEVE_PAGE_REQUEST "RTP" //retrieve, one page at a time (history)
+#define USER_TAIL_REQUEST "RTL" //retrieve the last messages (tail)
 
 //:::::::::::::::::::::::::: ANSWER ::::::::::::::::::::::::::://
 #define USER_REG_ANSWER "RRG" //reg
@@ -108,9 +200,26 @@
 #define USER_SUBSCRIBE_ANSWER "RGS" //subscribe
 #define USER_UNSUBSCRIBE_ANSWER "RGU" //unsubscribe
 #define USER_MY_GROUPS_ANSWER "RGM" //my_groups
+#define USER_GROUPS_PAGE_ANSWER "RGP" //groups, one page at a time
+#define USER_MY_GROUPS_PAGE_ANSWER "RMP" //my_groups, one page at a time
+#define USER_GROUPS_DELTA_ANSWER "RGD" //groups, changed since a version
+#define USER_MY_GROUPS_DELTA_ANSWER "RMD" //my_groups, changed since a version
+#define USER_INBOX_ANSWER "RIB" //inbox
 #define USER_ULIST_ANSWER "RUL" //ulist
 #define USER_POST_ANSWER "RPT" //post
 #define USER_RETRIEVE_ANSWER "RRT" //retrieve
+#define USER_RETRIEVE_META_ANSWER "RRM" //retrieve, without the attachments' data (-m)
+#define USER_ATTACHMENT_ANSWER "RAT" //attachment
+#define USER_RANGE_ANSWER "RAR" //attachment, a byte range of it
+#define USER_UPLOAD_OPEN_ANSWER "RUO" //post, opening an upload (-u)
+#define USER_UPLOAD_CHUNK_ANSWER "RUC" //post, a chunk of an upload (-u)
+#define USER_UPLOAD_QUERY_ANSWER "RUQ" //post, the bytes of an upload received (-u)
+#define USER_UPLOAD_COMMIT_ANSWER "RUF" //post, committing an upload (-u)
+#define USER_SESSION_ANSWER "RSE" //persistent TCP session
+#define USER_WATCH_ANSWER "RWT" //watch
+#define USER_FEED_ANSWER "RFD" //feed
+#define USER_RETRIEVE_PAGE_ANSWER "RRP" //retrieve, one page at a time (history)
+#define USER_TAIL_ANSWER "RRL" //retrieve the last messages (tail)
 
 //:::::::::::::::::::::::::: STATUS ::::::::::::::::::::::::::://
 #define NEW "NEW"
@@ -118,10 +227,12 @@
 #define DUP "DUP"
 #define NOK "NOK"
 #define ERR "ERR"
+#define BUSY "BSY" //over budget: retry later
 #define E_USR "E_USR"
 #define E_GRP "E_GRP"
 #define E_GNAME "E_GNAME"
 #define E_FULL "E_FULL"
+#define E_RANGE "E_RANGE"
 #define ZERO "0"
 #define EOF_ "EOF"
 
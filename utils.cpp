@@ -18,6 +18,107 @@ namespace parsers{
         return false;
     }
     
+    //:::::::::::::::::::: CHARACTER CLASSES :::::::::::::::::::://
+    /* The classes of each of the 256 characters (CLASS_* bits) */
+    typedef struct classes {
+        unsigned char of[256];
+    } CLASSES;
+
+    /**
+     * Builds the character class table, at compile time.
+     * 
+     * @return constexpr CLASSES the table
+     */
+    static constexpr CLASSES make_classes(){
+        CLASSES table = {};
+        for (int c = '0'; c <= '9'; c++){
+            table.of[c] |= CLASS_DIGIT | CLASS_NAME | CLASS_FNAME;
+        }
+        for (int c = 'A'; c <= 'Z'; c++){
+            table.of[c] |= CLASS_LETTER | CLASS_NAME | CLASS_FNAME;
+            table.of[c + 'a' - 'A'] |= CLASS_LETTER | CLASS_NAME | CLASS_FNAME;
+        }
+        table.of[(int) '-'] |= CLASS_NAME | CLASS_FNAME;
+        table.of[(int) '_'] |= CLASS_NAME | CLASS_FNAME;
+        table.of[(int) '.'] |= CLASS_FNAME;
+        return table;
+    }
+    static constexpr CLASSES CHAR_CLASSES = make_classes();
+
+#ifdef __SSE2__
+    /**
+     * Marks the bytes of a 16-byte block which are within [lo, hi].
+     * Bytes above 0x7F are negative as signed bytes, so they're 
+     * never within an ASCII range.
+     * 
+     * @param block the block
+     * @param lo the lowest character of the range
+     * @param hi the highest character of the range
+     * @return __m128i 0xFF on the bytes within the range, 0 on the 
+     * others
+     */
+    static inline __m128i in_range(__m128i block, char lo, char hi){
+        return _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8(lo - 1)), 
+            _mm_cmplt_epi8(block, _mm_set1_epi8(hi + 1)));
+    }
+
+    /**
+     * Checks if all 16 bytes of a block belong to a set of classes.
+     * 
+     * @param data the block (16 bytes)
+     * @param classes the classes (CLASS_* bits)
+     * @return true if they all belong to one of the classes
+     * @return false if they don't
+     */
+    static inline bool block_of_class(const char * data, unsigned char classes){
+        __m128i block = _mm_loadu_si128((const __m128i *) data);
+        __m128i match = _mm_setzero_si128();
+
+        if (classes & (CLASS_DIGIT | CLASS_NAME | CLASS_FNAME)){
+            match = _mm_or_si128(match, in_range(block, '0', '9'));
+        }
+        if (classes & (CLASS_LETTER | CLASS_NAME | CLASS_FNAME)){
+            match = _mm_or_si128(match, in_range(block, 'A', 'Z'));
+            match = _mm_or_si128(match, in_range(block, 'a', 'z'));
+        }
+        if (classes & (CLASS_NAME | CLASS_FNAME)){
+            match = _mm_or_si128(match, _mm_cmpeq_epi8(block, _mm_set1_epi8('-')));
+            match = _mm_or_si128(match, _mm_cmpeq_epi8(block, _mm_set1_epi8('_')));
+        }
+        if (classes & CLASS_FNAME){
+            match = _mm_or_si128(match, _mm_cmpeq_epi8(block, _mm_set1_epi8('.')));
+        }
+        return _mm_movemask_epi8(match) == 0xFFFF;
+    }
+#endif
+
+    /**
+     * Checks if every character of a string belongs to a set of 
+     * classes. Blocks of 16 characters are checked at once with 
+     * SSE2 (when available); the rest uses the class table.
+     * 
+     * @param input the string to be checked
+     * @param classes the classes (CLASS_* bits)
+     * @return true if they all belong to one of the classes
+     * @return false if they don't
+     */
+    bool all_of_class(string_view input, unsigned char classes){
+        size_t i = 0;
+#ifdef __SSE2__
+        for (; i + 16 <= input.size(); i += 16){
+            if (!block_of_class(input.data() + i, classes)){
+                return false;
+            }
+        }
+#endif
+        for (; i < input.size(); i++){
+            if (!(CHAR_CLASSES.of[(unsigned char) input[i]] & classes)){
+                return false;
+            }
+        }
+        return true;
+    }
+
     /**
      * Indicates if a string is a UID or not.
      * A UID consists of 5 alphanumerical characters, restricted to
@@ -27,17 +128,8 @@ namespace parsers{
      * @return true if it's a UID
      * @return false if it's not a UID
      */
-    bool parse_uid(string input){
-        int len = input.length();
-        if (len != 5){
-            return false;
-        }
-        for (int i = 0; i < len; i++){
-            if (!(is_number(input[i]))){
-                return false;
-            }
-        }
-        return true;
+    bool parse_uid(string_view input){
+        return (input.length() == MAX_UID) && all_of_class(input, CLASS_DIGIT);
     }
 
     /**
@@ -49,17 +141,8 @@ namespace parsers{
      * @return true if it's a pass
      * @return false if it's not a pass
      */
-    bool parse_pass(string input){
-        int len = input.length();
-        if (len != 8){
-            return false;
-        }
-        for (int i = 0; i < len; i++){
-            if(!(is_number(input[i]) || is_letter(input[i]))){
-                return false;
-            }
-        }
-        return true;
+    bool parse_pass(string_view input){
+        return (input.length() == MAX_PASS) && all_of_class(input, CLASS_DIGIT | CLASS_LETTER);
     }
 
     /**
@@ -71,17 +154,8 @@ namespace parsers{
      * @return true if it's a GID
      * @return false if it's not a GID
      */
-    bool parse_gid(const string input){
-        int len = input.length();
-        if(len != 2){
-            return false;
-        }
-        for(int i = 0; i < len; i++){
-            if(!(is_number(input[i]))){
-                return false;
-            }
-        }
-        return true;
+    bool parse_gid(string_view input){
+        return (input.length() == MAX_GID) && all_of_class(input, CLASS_DIGIT);
     }
 
     /**
@@ -93,18 +167,36 @@ namespace parsers{
      * @return true if it's a GName
      * @return false if it's not a GName
      */
-    bool parse_gname(const string input){
+    bool parse_gname(string_view input){
         int len = input.length();
-        if((len > 24) || (len == 0)){
+        if((len > MAX_GNAME) || (len == 0)){
             return false;
         }
+        return all_of_class(input, CLASS_NAME);
+    }
 
-        for(int i = 0; i < len; i++){
-            if(!is_number(input[i]) && !is_letter(input[i]) && input[i] != '-' && input[i] != '_'){
-                return false;
-            }
-        }
-        return true;
+    /**
+     * Indicates if a string is the count of a paged request or not.
+     * A count consists of 2 numerical characters, and can't be 00.
+     *
+     * @param input the string to be parsed
+     * @return true if it's a count
+     * @return false if it's not a count
+     */
+    bool parse_count(string_view input){
+        return parse_gid(input) && (input != "00");
+    }
+
+    /**
+     * Indicates if a string is a catalog version or not.
+     * A version consists of up to 10 numerical characters.
+     *
+     * @param input the string to be parsed
+     * @return true if it's a version
+     * @return false if it's not a version
+     */
+    bool parse_version(string_view input){
+        return !input.empty() && (input.length() <= MAX_VERSION) && all_of_class(input, CLASS_DIGIT);
     }
 
     /**
@@ -116,17 +208,8 @@ namespace parsers{
      * @return true if it's a MID
      * @return false if it's not a MID
      */
-    bool parse_mid(const string input){
-        int len = input.length();
-        if(len != 4){
-            return false;
-        }
-        for(int i = 0; i < len; i++){
-            if(!(is_number(input[i]))){
-                return false;
-            }
-        }
-        return true;
+    bool parse_mid(string_view input){
+        return (input.length() == MAX_MID) && all_of_class(input, CLASS_DIGIT);
     }
 
     /**
@@ -139,26 +222,16 @@ namespace parsers{
      * @return true if it's a Fname
      * @return false if it's not a Fname
      */
-    bool parse_fname(const string input){
+    bool parse_fname(string_view input){
         int len = input.length();
-        if((len > 24) || (len < 5)){
+        if((len > MAX_FNAME) || (len < 5)){
             return false;
         }
-        for(int i = 0; i < len - 4; i++){
-            if(!is_number(input[i]) && !is_letter(input[i]) 
-                && input[i] != '-' && input[i] != '_' && input[i] != '.'){
-                return false;
-            }
-        }
         if(input[len - 4] != '.'){
             return false;
         }
-        for(int i = len - 3; i < len; i++){
-            if(!is_letter(input[i])){
-                return false;
-            }
-        }
-        return true;
+        return all_of_class(input.substr(0, len - 4), CLASS_FNAME) 
+            && all_of_class(input.substr(len - 3), CLASS_LETTER);
     }
 
     /**
@@ -170,17 +243,12 @@ namespace parsers{
      * @return true 
      * @return false 
      */
-    bool parse_fsize(const string input){
+    bool parse_fsize(string_view input){
         int len = input.length();
-        if(len > 10){
+        if((len > MAX_FSIZE) || (len == 0)){
             return false;
         }
-        for(int i = 0; i < len; i++){
-            if(!(is_number(input[i]))){
-                return false;
-            }
-        }
-        return true;
+        return all_of_class(input, CLASS_DIGIT);
     }
     
     /**
@@ -191,7 +259,7 @@ namespace parsers{
      * @return true if it's a text 
      * @return false if it's not a text
      */
-    bool parse_text(const string input){
+    bool parse_text(string_view input){
         int len = input.length();
         if(len > 240){
             return false;
@@ -208,17 +276,15 @@ namespace parsers{
      * @return true 
      * @return false 
      */
-    bool parse_tsize(const string input){
+    bool parse_tsize(string_view input){
         int len = input.length();
-        if(len > 3){
+        if((len > MAX_TSIZE) || (len == 0)){
             return false;
         }
-        for(int i = 0; i < len; i++){
-            if(!(is_number(input[i]))){
-                return false;
-            }
+        if (!all_of_class(input, CLASS_DIGIT)){
+            return false;
         }
-        if ((stoi(input) > 240) || (stoi(input) < 0)){
+        if (auxiliaries::to_number(input) > MAX_TEXT){
             return false;
         }
         return true;
@@ -232,8 +298,7 @@ namespace parsers{
      * @return false if it's not a number
      */
     bool is_number(char input){
-        return ((int)input >= (int)'0') 
-            && ((int)input <= (int)'9');
+        return CHAR_CLASSES.of[(unsigned char) input] & CLASS_DIGIT;
     }
 
     /**
@@ -244,10 +309,152 @@ namespace parsers{
      * @return false if it's not a letter
      */
     bool is_letter(char input){
-        return (((int)input >= (int)'A') 
-            && ((int)input <= (int)'Z')) ||
-            (((int)input >= (int)'a') 
-            && ((int)input <= (int)'z')); 
+        return CHAR_CLASSES.of[(unsigned char) input] & CLASS_LETTER;
+    }
+
+    //::::::::::::::::::::: REQUEST SCHEMA :::::::::::::::::::::://
+    /**
+     * The format of each UDP request, shared by the DS and the user
+     * application: the fields which follow the request code, how
+     * each is validated, and the status answered when it isn't.
+     */
+    static constexpr SCHEMA UDP_SCHEMA[] = {
+        {USER_REG_REQUEST, USER_REG_ANSWER, 2, {{FIELD_UID, ERR}, {FIELD_PASS, ERR}}},
+        {USER_UNREGISTER_REQUEST, USER_UNREGISTER_ANSWER, 2, {{FIELD_UID, ERR}, {FIELD_PASS, ERR}}},
+        {USER_LOGIN_REQUEST, USER_LOGIN_ANSWER, 2, {{FIELD_UID, ERR}, {FIELD_PASS, ERR}}},
+        {USER_LOGOUT_REQUEST, USER_LOGOUT_ANSWER, 2, {{FIELD_UID, ERR}, {FIELD_PASS, ERR}}},
+        {USER_GROUPS_REQUEST, USER_GROUPS_ANSWER, 0, {}},
+        {USER_SUBSCRIBE_REQUEST, USER_SUBSCRIBE_ANSWER, 3, {{FIELD_UID, E_USR}, {FIELD_GID, E_GRP}, {FIELD_GNAME, E_GNAME}}},
+        {USER_UNSUBSCRIBE_REQUEST, USER_UNSUBSCRIBE_ANSWER, 2, {{FIELD_UID, E_USR}, {FIELD_GID, E_GRP}}},
+        {USER_MY_GROUPS_REQUEST, USER_MY_GROUPS_ANSWER, 1, {{FIELD_UID, E_USR}}},
+        {USER_GROUPS_PAGE_REQUEST, USER_GROUPS_PAGE_ANSWER, 2, {{FIELD_GID, ERR}, {FIELD_COUNT, ERR}}},
+        {USER_MY_GROUPS_PAGE_REQUEST, USER_MY_GROUPS_PAGE_ANSWER, 3, {{FIELD_UID, E_USR}, {FIELD_GID, ERR}, {FIELD_COUNT, ERR}}},
+        {USER_GROUPS_DELTA_REQUEST, USER_GROUPS_DELTA_ANSWER, 3, {{FIELD_VERSION, ERR}, {FIELD_GID, ERR}, {FIELD_COUNT, ERR}}},
+        {USER_MY_GROUPS_DELTA_REQUEST, USER_MY_GROUPS_DELTA_ANSWER, 4, 
+            {{FIELD_UID, E_USR}, {FIELD_VERSION, ERR}, {FIELD_GID, ERR}, {FIELD_COUNT, ERR}}},
+        {USER_INBOX_REQUEST, USER_INBOX_ANSWER, 2, {{FIELD_UID, E_USR}, {FIELD_VERSION, ERR}}},
+    };
+    static constexpr int N_UDP_SCHEMA = sizeof(UDP_SCHEMA) / sizeof(SCHEMA);
+
+    /**
+     * Indicates if a field of a request is valid, given its kind.
+     * 
+     * @param kind the kind of field
+     * @param input the field
+     * @return true if it's valid
+     * @return false if it's not
+     */
+    bool parse_field(FIELD_KIND kind, const char * input){
+        switch(kind){
+            case FIELD_UID:
+                return parse_uid(input);
+            case FIELD_PASS:
+                return parse_pass(input);
+            case FIELD_GID:
+                return parse_gid(input);
+            case FIELD_GNAME:
+                return parse_gname(input);
+            case FIELD_COUNT:
+                return parse_count(input);
+            case FIELD_VERSION:
+                return parse_version(input);
+        }
+        return false;
+    }
+
+    /**
+     * Gets the schema of a UDP request, given its request code.
+     * 
+     * @param request the request code (or the request itself)
+     * @return const SCHEMA* the schema, or NULL if it isn't a UDP
+     * request
+     */
+    const SCHEMA * find_schema(const char * request){
+        if ((strnlen(request, 4) < 3) || ((request[3] != ' ') && (request[3] != '\n') && (request[3] != '\0'))){
+            return NULL;
+        }
+        uint32_t code = auxiliaries::pack_opcode(request);
+        for (int i = 0; i < N_UDP_SCHEMA; i++){
+            if (code == auxiliaries::pack_opcode(UDP_SCHEMA[i].request)){
+                return &UDP_SCHEMA[i];
+            }
+        }
+        return NULL;
+    }
+
+    /**
+     * Parses a UDP request according to its schema, in place: no 
+     * memory is allocated. The fields must be separated by single
+     * spaces, and the request must end with '\n'.
+     * 
+     * @param request the request
+     * @param schema gets the schema of the request
+     * @param fields gets the fields which follow the request code
+     * @return int FAIL if the request is malformed, or else the 
+     * number of valid fields before the first invalid one (which is
+     * the number of fields, if they're all valid)
+     */
+    int parse_request(const char * request, const SCHEMA ** schema, char fields[][MAX_FIELD + 1]){
+        *schema = find_schema(request);
+        if (*schema == NULL){
+            return FAIL;
+        }
+
+        const char * ptr = request + 3;
+        int invalid = (*schema)->nfields;
+        for (int i = 0; i < (*schema)->nfields; i++){
+            if (*ptr != ' '){
+                return FAIL;
+            }
+            ptr++;
+
+            int len = strcspn(ptr, " \n");
+            if (len == 0){
+                return FAIL;
+            }
+            /* Too long to be valid: keep what fits, to be rejected */
+            if ((len > MAX_FIELD) && (invalid > i)){
+                invalid = i;
+            }
+            int copy = len > MAX_FIELD ? MAX_FIELD : len;
+            memcpy(fields[i], ptr, copy);
+            fields[i][copy] = '\0';
+            ptr += len;
+        }
+        if ((ptr[0] != '\n') || (ptr[1] != '\0')){
+            return FAIL;
+        }
+
+        for (int i = 0; i < invalid; i++){
+            if (!parse_field((*schema)->fields[i].kind, fields[i])){
+                return i;
+            }
+        }
+        return invalid;
+    }
+
+    /**
+     * Writes a UDP request according to its schema.
+     * Format: REQ[ field]*
+     * 
+     * @param schema the schema of the request
+     * @param fields the fields which follow the request code
+     * @param request gets the request (at least MAX_REQUEST_UDP 
+     * bytes)
+     * @return int the length of the request, or FAIL if it doesn't
+     * fit
+     */
+    int serialize_request(const SCHEMA * schema, const char * const * fields, char * request){
+        int len = snprintf(request, MAX_REQUEST_UDP, "%s", schema->request);
+        for (int i = 0; i < schema->nfields; i++){
+            len += snprintf(request + len, MAX_REQUEST_UDP - len, " %s", fields[i]);
+            if (len >= MAX_REQUEST_UDP - 1){
+                return FAIL;
+            }
+        }
+        request[len++] = '\n';
+        request[len] = '\0';
+        return len;
     }
 }
 
@@ -263,9 +470,9 @@ namespace checkers{
      * @return true if if matches
      * @return false if it doesn't
      */
-    bool check_nparam(int nparams, int expected, string command){
+    bool check_nparam(int nparams, int expected, string_view command){
         if(!parsers::parse_nparam(nparams, expected)){
-            fprintf(stderr, "%d arguments expected. Wrong format for %s.\n", expected, command.c_str());
+            fprintf(stderr, "%d arguments expected. Wrong format for %.*s.\n", expected, (int) command.size(), command.data());
             return false;
         }
         return true;
@@ -279,9 +486,9 @@ namespace checkers{
      * @return true if it's a valid uid
      * @return false if it's not
      */
-    bool check_uid(string uid, string command){
+    bool check_uid(string_view uid, string_view command){
         if(!parsers::parse_uid(uid)){
-            fprintf(stderr, "Wrong format for UID. Unable to %s.\n", command.c_str());
+            fprintf(stderr, "Wrong format for UID. Unable to %.*s.\n", (int) command.size(), command.data());
             return false;
         }
         return true;
@@ -295,9 +502,9 @@ namespace checkers{
      * @return true if it's a valid pass
      * @return false if it's not 
      */
-    bool check_pass(string pass, string command){
+    bool check_pass(string_view pass, string_view command){
         if(!parsers::parse_pass(pass)){
-            fprintf(stderr, "Wrong format for pass. Unable to %s.\n", command.c_str());
+            fprintf(stderr, "Wrong format for pass. Unable to %.*s.\n", (int) command.size(), command.data());
             return false;
         }
         return true;
@@ -311,9 +518,9 @@ namespace checkers{
      * @return true if it's a valid gid
      * @return false if it's not 
      */
-    bool check_gid(string gid, string command){
+    bool check_gid(string_view gid, string_view command){
         if(!parsers::parse_gid(gid)){
-            fprintf(stderr, "Wrong format for GID. Unable to %s.\n", command.c_str());
+            fprintf(stderr, "Wrong format for GID. Unable to %.*s.\n", (int) command.size(), command.data());
             return false;
         }
         return true;
@@ -327,9 +534,9 @@ namespace checkers{
      * @return true if it's a valid gname
      * @return false if it's not 
      */
-    bool check_gname(string gname, string command){
+    bool check_gname(string_view gname, string_view command){
         if(!parsers::parse_gname(gname)){
-            fprintf(stderr, "Wrong format for GName. Unable to %s.\n", command.c_str());
+            fprintf(stderr, "Wrong format for GName. Unable to %.*s.\n", (int) command.size(), command.data());
             return false;
         }
         return true;
@@ -343,9 +550,28 @@ namespace checkers{
      * @return true if it's a valid mid
      * @return false if it's not 
      */
-    bool check_mid(string mid, string command){
+    bool check_mid(string_view mid, string_view command){
         if (!parsers::parse_mid(mid)){
-            fprintf(stderr, "Wrong format for mid. Unable to %s.\n", command.c_str());
+            fprintf(stderr, "Wrong format for mid. Unable to %.*s.\n", (int) command.size(), command.data());
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Checks wether the count parameter represents a valid number
+     * of messages (1 or 2 numerical characters, from 1 to limit).
+     * 
+     * @param count the count parameter
+     * @param limit the maximum number of messages
+     * @param command the command which requires this validation
+     * @return true if it's a valid count
+     * @return false if it's not 
+     */
+    bool check_count(string_view count, int limit, string_view command){
+        if ((count.size() > MAX_N) || !parsers::all_of_class(count, CLASS_DIGIT) || (auxiliaries::to_number(count) < 1) 
+            || (auxiliaries::to_number(count) > limit)){
+            fprintf(stderr, "Wrong format for count (1 to %d). Unable to %.*s.\n", limit, (int) command.size(), command.data());
             return false;
         }
         return true;
@@ -359,9 +585,9 @@ namespace checkers{
      * @return true if it's a valid fname
      * @return false if it's not 
      */
-    bool check_fname(string fname, string command){
+    bool check_fname(string_view fname, string_view command){
         if (!parsers::parse_fname(fname)){
-            fprintf(stderr, "Wrong format for fname. Unable to %s.\n", command.c_str());
+            fprintf(stderr, "Wrong format for fname. Unable to %.*s.\n", (int) command.size(), command.data());
             return false;
         }
         return true;
@@ -375,9 +601,9 @@ namespace checkers{
      * @return true if it's a valid fsize
      * @return false if it's not
      */
-    bool check_fsize(string fsize, string command){
+    bool check_fsize(string_view fsize, string_view command){
          if (!parsers::parse_fsize(fsize)){
-            fprintf(stderr, "Wrong format for fsize. Unable to %s.\n", command.c_str());
+            fprintf(stderr, "Wrong format for fsize. Unable to %.*s.\n", (int) command.size(), command.data());
             return false;
         }
         return true;
@@ -391,9 +617,9 @@ namespace checkers{
      * @return true if it's a valid text
      * @return false if it's not 
      */
-    bool check_text(string text, string command){
+    bool check_text(string_view text, string_view command){
         if (!parsers::parse_text(text)){
-            fprintf(stderr, "Wrong format for text. Unable to %s.\n", command.c_str());
+            fprintf(stderr, "Wrong format for text. Unable to %.*s.\n", (int) command.size(), command.data());
             return false;
         }
         return true;
@@ -407,9 +633,9 @@ namespace checkers{
      * @return true if it's a valid tsize
      * @return false if it's not
      */
-    bool check_tsize(string tsize, string command){
+    bool check_tsize(string_view tsize, string_view command){
         if (!parsers::parse_tsize(tsize)){
-            fprintf(stderr, "Wrong format for tsize. Unable to %s.\n", command.c_str());
+            fprintf(stderr, "Wrong format for tsize. Unable to %.*s.\n", (int) command.size(), command.data());
             return false;
         }
         return true;
@@ -428,6 +654,134 @@ namespace protocols{
         free(s);
     }
 
+    /**
+     * Sets the read and write deadlines of a TCP socket: any single
+     * read or write blocked for longer than the given time fails, so
+     * a peer that stalls mid-request can't hold the session forever.
+     * The timers are kept by the kernel, so their cost per connec-
+     * tion doesn't depend on how many sessions are open.
+     * 
+     * @param s the pointer to the socket structure
+     * @param seconds the deadline of each read/write, in seconds
+     * @return int SUCCESS or FAIL
+     */
+    int set_deadlines(SOCKET * s, int seconds){
+        struct timeval tv;
+        tv.tv_sec = seconds;
+        tv.tv_usec = 0;
+
+        if (setsockopt(s->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == FAIL){
+            return FAIL;
+        }
+        if (setsockopt(s->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == FAIL){
+            return FAIL;
+        }
+        return SUCCESS;
+    }
+
+    /**
+     * Waits until a TCP socket has bytes to be read, for as long as
+     * its deadline allows. Unlike the deadlines of set_deadlines,
+     * which restart with each read, this one is a moment in time: a
+     * peer that sends a byte now and then can't make a request last
+     * past it.
+     * 
+     * @param s the pointer to the socket structure
+     * @return true if the socket can be read (or has no deadline)
+     * @return false if the deadline expired
+     */
+    bool before_deadline(SOCKET * s){
+        if (s->deadline == 0){
+            return true;
+        }
+        while (true){
+            time_t left = s->deadline - time(NULL);
+            if (left <= 0){
+                return false;
+            }
+            struct pollfd pfd;
+            pfd.fd = s->fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            int ready = poll(&pfd, 1, left * 1000);
+            if ((ready == FAIL) && (errno == EINTR)) continue;
+            return ready > 0;
+        }
+    }
+
+    /* Maximum number of bytes per second each file transfer may use
+    (0 means unlimited) */
+    static long bandwidth_cap = 0;
+
+    /**
+     * Sets the maximum bandwidth (bytes per second) each file trans-
+     * fer may use, so that a single huge download can't take the 
+     * whole link from the other sessions.
+     * 
+     * @param bytes_per_sec the bandwidth cap (0 means unlimited)
+     */
+    void set_bandwidth(long bytes_per_sec){
+        bandwidth_cap = bytes_per_sec;
+    }
+
+    /**
+     * Holds a file transfer back for as long as it is ahead of the
+     * bandwidth cap.
+     * 
+     * @param start the moment the transfer started
+     * @param nbytes the number of bytes transfered so far
+     */
+    void pace(struct timeval start, long nbytes){
+        if (bandwidth_cap <= 0){
+            return;
+        }
+        struct timeval now;
+        gettimeofday(&now, NULL);
+
+        long elapsed = (now.tv_sec - start.tv_sec) * 1000000L + (now.tv_usec - start.tv_usec);
+        long expected = (long) (nbytes * 1000000.0 / bandwidth_cap);
+        if (expected > elapsed){
+            usleep(expected - elapsed);
+        }
+    }
+
+    /**
+     * Moves a TCP socket to one of two traffic lanes, by setting the
+     * type of service of its packets. LANE_LATENCY (low delay) is 
+     * used for requests and short replies, and LANE_BULK (through-
+     * put) only while attachment data is being streamed, so the 
+     * network queues let short replies go ahead of bulk bytes.
+     * 
+     * @param s the pointer to the socket structure
+     * @param lane either LANE_LATENCY or LANE_BULK
+     * @return int SUCCESS or FAIL
+     */
+    int set_lane(SOCKET * s, int lane){
+        int tos = (lane == LANE_BULK) ? IPTOS_THROUGHPUT : IPTOS_LOWDELAY;
+        if (setsockopt(s->fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) == FAIL){
+            return FAIL;
+        }
+        return SUCCESS;
+    }
+
+    /**
+     * Indicates if a file transfer is going slower than the minimum
+     * transfer rate (MIN_TRANSFER_RATE bytes per second). Every 
+     * transfer gets TRANSFER_GRACE seconds before being checked.
+     * 
+     * @param start the moment the transfer started
+     * @param nbytes the number of bytes transfered so far
+     * @return true if the transfer is too slow
+     * @return false if it isn't
+     */
+    bool too_slow(time_t start, long nbytes){
+        long elapsed = (long) (time(NULL) - start);
+        if (elapsed < TRANSFER_GRACE){
+            return false;
+        }
+        return nbytes < elapsed * MIN_TRANSFER_RATE;
+    }
+
     //:::::::::::::::::::: GENERIC SENDERS :::::::::::::::::::://
     /**
      * Sends a message using a UDP socket.
@@ -436,7 +790,7 @@ namespace protocols{
      * @param message the message to be sent
      * @return int SUCCESS or FAIL
      */
-    int sendUDP(SOCKET * s, string message){
+    int sendUDP(SOCKET * s, const string & message){
         /* The way to send a UDP message is different depending 
         on who sends it (USER or SERVER) */
         if (!strcmp(s->owner, USER)){
@@ -460,17 +814,16 @@ namespace protocols{
      * @param s the pointer to the socket structure
      * @param message the message to be sent
      * @param nbytes the number of bytes (characters) we want to
-     * send
+     * send; the message is sent from where it is, so it may be of
+     * any length
      * @return int SUCCESS or FAIL
      */
     int sendTCP(SOCKET * s, string message, int nbytes){
         ssize_t nleft, n;
         int nwritten = 0;
-        char * ptr, buffer[MAX_STRING_TCP];
-
-        ptr = strcpy(buffer, message.c_str());
+        const char * ptr = message.data();
 
-        nleft=nbytes;
+        nleft = min((size_t) nbytes, message.size());
         while(nleft > 0){
             n = write(s->fd, ptr, nleft);
             if(n <= 0){
@@ -484,15 +837,43 @@ namespace protocols{
         return nwritten;
     }
 
+    /**
+     * Sends raw bytes using a TCP socket. Unlike sendTCP, the data
+     * may hold '\0' bytes (e.g. the fields of a framed request).
+     * 
+     * @param s the pointer to the socket structure
+     * @param data the bytes to be sent
+     * @param nbytes the number of bytes to be sent
+     * @return int the number of bytes sent or FAIL
+     */
+    int sendbytesTCP(SOCKET * s, const char * data, int nbytes){
+        ssize_t nleft, n;
+        const char * ptr = data;
+
+        nleft = nbytes;
+        while(nleft > 0){
+            n = write(s->fd, ptr, nleft);
+            if(n <= 0){
+                fprintf(stderr, "Unable to send message, please try again!\n");
+                return FAIL;
+            }
+            nleft -= n;
+            ptr += n;
+        }
+        return nbytes;
+    }
+
     //::::::::::::::::::: GENERIC RECEIVERS ::::::::::::::::::://
     /**
      * Waits for a UDP socket to receive a message.
      * 
      * @param s the pointer to the socket structure
      * @param message the message to be received
-     * @return int SUCCESS or FAIL
+     * @param size the size of the message buffer; longer datagrams 
+     * are truncated to it
+     * @return int FAIL or the number of bytes received
      */
-    int receiveUDP(SOCKET * s, char * message){
+    int receiveUDP(SOCKET * s, char * message, int size){
         int tries = 0;
         struct timeval tv;
         fd_set rfds;
@@ -523,13 +904,13 @@ namespace protocols{
                     exit(EXIT_FAILURE);
                 }
                 default:{
-                    int i = recvfrom(s->fd, message, MAX_STRING_UDP, 0, (struct sockaddr*)&(s->addr), &addrlen);
+                    int i = recvfrom(s->fd, message, size, 0, (struct sockaddr*)&(s->addr), &addrlen);
 	                if(i == FAIL){
                         fprintf(stderr, "Unable to receive message, please try again!");
                         return FAIL;
                     }
 
-                    return SUCCESS;
+                    return i;
                 }
             }
             tries++;
@@ -553,11 +934,25 @@ namespace protocols{
         ptr = message;
 
         while(nleft > 0){
-            nread = read(s->fd, ptr, nleft);
-            if(nread == FAIL){
-                break;  
+            /* Bytes already buffered are consumed first */
+            if(s->rpos < s->rlen){
+                nread = min((ssize_t) (s->rlen - s->rpos), nleft);
+                memcpy(ptr, s->rbuf + s->rpos, nread);
+                s->rpos += nread;
+            }
+            /* Big reads go straight to the destination */
+            else if(nleft >= RECV_BUFFER){
+                if(!before_deadline(s)) break;
+                nread = read(s->fd, ptr, nleft);
+                if(nread == FAIL){
+                    break;  
+                }
+                else if(nread == 0) break;
+            }
+            else{
+                if(fill_buffer(s) <= 0) break;
+                continue;
             }
-            else if(nread == 0) break;
             nleft -= nread;
             ptr += nread;
         }
@@ -565,6 +960,31 @@ namespace protocols{
         return nread;
     }
 
+    /**
+     * Refills the receive buffer of a TCP socket, with whatever is
+     * available (up to RECV_BUFFER bytes), once it's all consumed.
+     * 
+     * @param s the pointer to the socket structure
+     * @return int the number of bytes buffered, 0 if the connection
+     * was closed or FAIL
+     */
+    int fill_buffer(SOCKET * s){
+        if(s->rpos < s->rlen){
+            return s->rlen - s->rpos;
+        }
+        s->rpos = 0;
+        s->rlen = 0;
+        if(!before_deadline(s)){
+            return FAIL;
+        }
+        ssize_t nread = read(s->fd, s->rbuf, RECV_BUFFER);
+        if(nread <= 0){
+            return nread == 0 ? 0 : FAIL;
+        }
+        s->rlen = nread;
+        return nread;
+    }
+
     //:::::::::::::::::::: UDP AUXILIARIES :::::::::::::::::::://
     /**
      * Sends the reply command and status using a UDP socket.
@@ -576,7 +996,7 @@ namespace protocols{
      */
     int sendstatusUDP(SOCKET * s, string command, string status){
         string buffer;
-        if(status == ERR){
+        if((status == ERR) || (status == BUSY)){
             buffer = status + "\n";
         }else{
             buffer = command + " " + status + "\n";
@@ -599,7 +1019,7 @@ namespace protocols{
      */
     int sendstatusTCP(SOCKET * s, string command, string status){
         string buffer;
-        if(status == ERR){
+        if((status == ERR) || (status == BUSY)){
             buffer = status + "\n";
         }else{
             buffer = command + " " + status + "\n";
@@ -615,26 +1035,48 @@ namespace protocols{
 
     //:::::::::::::::::::: TCP AUXILIARIES :::::::::::::::::::://
     /**
-     * Sends a file using a TCP socket.
+     * Sends a file using a TCP socket. While the file data is being
+     * streamed the socket is moved to the bulk lane (see set_lane),
+     * so the short replies of other sessions are not stuck behind 
+     * it; it goes back to the latency lane once the file is sent.
      * 
      * @param s the pointer to the socket structure
      * @param fp the pointer to the file to be sent
      * @return int SUCCESS or FAIL
      */
     int sendfileTCP(SOCKET * s, FILE * file){
+        set_lane(s, LANE_BULK);
+        int res = streamfileTCP(s, file);
+        set_lane(s, LANE_LATENCY);
+        return res;
+    }
+
+    /**
+     * Streams the contents of a file through a TCP socket, without
+     * exceeding the bandwidth cap (if any).
+     * 
+     * @param s the pointer to the socket structure
+     * @param fp the pointer to the file to be sent
+     * @return int SUCCESS or FAIL
+     */
+    int streamfileTCP(SOCKET * s, FILE * file){
         /* source: https://coderedirect.com/questions/200858/send-binary-file-over-tcp-ip-connection */
 
         fseek(file, 0, SEEK_END);
-        int fsize = ftell(file);
+        long fsize = ftell(file);
         fseek(file, 0, SEEK_SET);
 
         if (fsize == EOF){
             return FAIL;
         }
         char buffer[MAX_STRING_TCP] = {'\0'};
+        time_t start = time(NULL);
+        struct timeval pace_start;
+        gettimeofday(&pace_start, NULL);
+        long nsent = 0;
         /* Send piece by piece (each one is 512 bytes at most) */
         while (fsize > 0){
-            int n = min(fsize, MAX_STRING_TCP);
+            int n = (int) min(fsize, (long) MAX_STRING_TCP);
             n = fread(buffer, 1, n, file);
             if (n < 1){
                 return FAIL;
@@ -653,12 +1095,122 @@ namespace protocols{
                 num -= nread;
             }
 
+            nsent += n;
+            if (too_slow(start, nsent)){
+                fprintf(stderr, "File transfer too slow. Giving up.\n");
+                return FAIL;
+            }
+            pace(pace_start, nsent);
+
             fsize -= n;
             bzero(buffer, MAX_STRING_TCP);
         }
         return SUCCESS;
     }
 
+    /**
+     * Sends a byte range of a file using a TCP socket, on the bulk
+     * lane (see sendfileTCP). On Linux the kernel copies the bytes
+     * from the file to the socket itself (sendfile); elsewhere they
+     * are read with pread, piece by piece.
+     * 
+     * @param s the pointer to the socket structure
+     * @param fd the file descriptor of the file
+     * @param offset the first byte of the range
+     * @param length the number of bytes of the range
+     * @return int SUCCESS or FAIL
+     */
+    int sendrangeTCP(SOCKET * s, int fd, off_t offset, long length){
+        set_lane(s, LANE_BULK);
+        time_t start = time(NULL);
+        struct timeval pace_start;
+        gettimeofday(&pace_start, NULL);
+
+        int res = SUCCESS;
+        long nsent = 0;
+        while (nsent < length){
+            long n = min(length - nsent, (long) RECV_BUFFER);
+#ifdef __linux__
+            /* sendfile moves the offset forward itself */
+            ssize_t nwritten = sendfile(s->fd, fd, &offset, n);
+#else
+            char buffer[RECV_BUFFER];
+            ssize_t nwritten = pread(fd, buffer, n, offset);
+            if ((nwritten > 0) && (sendbytesTCP(s, buffer, nwritten) == FAIL)){
+                nwritten = FAIL;
+            }
+            offset += (nwritten > 0) ? nwritten : 0;
+#endif
+            if (nwritten <= 0){
+                fprintf(stderr, "Unable to send file, please try again!\n");
+                res = FAIL;
+                break;
+            }
+
+            nsent += nwritten;
+            if (too_slow(start, nsent)){
+                fprintf(stderr, "File transfer too slow. Giving up.\n");
+                res = FAIL;
+                break;
+            }
+            pace(pace_start, nsent);
+        }
+        set_lane(s, LANE_LATENCY);
+        return res;
+    }
+
+    /**
+     * Waits for a TCP socket to receive a byte range of a file, and
+     * writes it to the file from the given offset. Unlike receive-
+     * fileTCP, the bytes received are kept if the transfer breaks, 
+     * so it can be resumed from where it stopped.
+     * 
+     * @param s the pointer to the socket structure
+     * @param path the name of the path of the file
+     * @param offset the first byte of the range
+     * @param length the number of bytes of the range
+     * @return int SUCCESS or FAIL
+     */
+    int receiverangeTCP(SOCKET * s, const char * path, off_t offset, long length){
+        int fd = open(path, O_WRONLY | O_CREAT, 0644);
+        if (fd == FAIL){
+            fprintf(stderr, "Unable to open file.\n");
+            return FAIL;
+        }
+
+        /* File data is bounded by its rate instead (see too_slow) */
+        s->deadline = 0;
+
+        char buffer[RECV_BUFFER];
+        time_t start = time(NULL);
+        long nreceived = 0;
+        while (nreceived < length){
+            int n = min(length - nreceived, (long) RECV_BUFFER);
+            /* What was received before the connection broke is 
+            kept too */
+            int nread = receiveTCP(s, buffer, n);
+            if ((nread > 0) && (pwrite(fd, buffer, nread, offset + nreceived) != nread)){
+                fprintf(stderr, "Unable to write to file, please try again!\n");
+                close(fd);
+                return FAIL;
+            }
+            if (nread < n){
+                fprintf(stderr, "Unable to receive file, please try again!\n");
+                close(fd);
+                return FAIL;
+            }
+
+            nreceived += nread;
+            if (too_slow(start, nreceived)){
+                fprintf(stderr, "File transfer too slow. Giving up.\n");
+                close(fd);
+                return FAIL;
+            }
+        }
+        close(fd);
+        return SUCCESS;
+    }
+
     /**
      * Waits for a TCP socket to receive a file.
      * 
@@ -667,34 +1219,32 @@ namespace protocols{
      * @param fsize the size (in bytes) of the received file
      * @return int SUCCESS or FAIL
      */
-    int receivefileTCP(SOCKET * s, char * path, int fsize){
+    int receivefileTCP(SOCKET * s, char * path, long fsize){
         /* source: https://coderedirect.com/questions/200858/send-binary-file-over-tcp-ip-connection */
 
         FILE * file = fopen(path, "wb");
         if (!file){
             fprintf(stderr, "Unable to open file.\n");
-            disconnect(s);
             return FAIL;
         }
 
+        /* File data is bounded by its rate instead (see too_slow) */
+        s->deadline = 0;
+
         char buffer[MAX_STRING_TCP] = {'\0'};
+        time_t start = time(NULL);
+        long nreceived = 0;
         while (fsize > 0){
-            int n = min(fsize, MAX_STRING_TCP);
-
-            /* Receive each piece of message from socket */
-            unsigned char *pbuf = (unsigned char *) buffer;
-            int num = n;
-            while(num > 0){
-                int nread = recv(s->fd, pbuf, num, 0);
-                if (nread == FAIL){
-                    fprintf(stderr, "Unable to receive file, please try again!\n");
-                    fclose(file);
-                    remove(path);
-                    return FAIL;
-                }
-
-                pbuf += nread;
-                num -= nread;
+            int n = (int) min(fsize, (long) MAX_STRING_TCP);
+
+            /* Receive each piece of message from socket. A closed 
+            connection or an expired deadline means the file will 
+            never be complete */
+            if (receiveTCP(s, buffer, n) < n){
+                fprintf(stderr, "Unable to receive file, please try again!\n");
+                fclose(file);
+                remove(path);
+                return FAIL;
             }
 
             /* Save each piece of message to the file */
@@ -710,6 +1260,14 @@ namespace protocols{
                 offset += nwritten;
             }
 
+            nreceived += n;
+            if (too_slow(start, nreceived)){
+                fprintf(stderr, "File transfer too slow. Giving up.\n");
+                fclose(file);
+                remove(path);
+                return FAIL;
+            }
+
             fsize -= n;
             bzero(buffer, MAX_STRING_TCP);
         }
@@ -724,21 +1282,38 @@ namespace protocols{
      * @param s the pointer to the socket structure
      * @param answer the word to be received
      * @param limit the maximum length of the word
+     * @param delimiter if not NULL, gets the character which ended
+     * the word (' ' or '\n'), or '\0' if there was none
      * @return int the number of characters/bytes read
      */
-    int word_receiveTCP(SOCKET * s, char * answer, int limit){
-        char buffer[MAX_STRING];
+    int word_receiveTCP(SOCKET * s, char * answer, int limit, char * delimiter){
         int nread = 0;
-        int i;
-        for(i = 0; i < limit; i++){
-            if(receiveTCP(s, buffer, 1) == FAIL){
-                return FAIL;
+        int i = 0;
+        if(delimiter != NULL){
+            delimiter[0] = '\0';
+        }
+        while(i < limit){
+            /* The connection was closed or the deadline expired */
+            if(fill_buffer(s) <= 0){
+                break;
             }
-            nread++;
-            if(buffer[0] == ' ' || buffer[0] == '\n'){
+
+            /* Look for the delimiter among the buffered bytes */
+            int n = min(s->rlen - s->rpos, limit - i);
+            int k = auxiliaries::find_delim(s->rbuf + s->rpos, n);
+            memcpy(answer + i, s->rbuf + s->rpos, k);
+            i += k;
+            nread += k;
+            s->rpos += k;
+
+            if(k < n){
+                if(delimiter != NULL){
+                    delimiter[0] = s->rbuf[s->rpos];
+                }
+                s->rpos++;
+                nread++;
                 break;
             }
-            answer[i] = buffer[0];
         }
 
         answer[i] = '\0';
@@ -758,7 +1333,7 @@ namespace protocols{
      * @param command 
      * @return 0 (false), 1 (true) or FAIL (-1)
      */
-    int uid_receiveTCP(SOCKET * s, char * uid, string command){
+    int uid_receiveTCP(SOCKET * s, char * uid, string_view command){
         memset(uid, '\0', MAX_UID + 1);
         int j = word_receiveTCP(s, uid, MAX_UID + 1);
         if (j == FAIL){
@@ -767,7 +1342,7 @@ namespace protocols{
         }
         uid[MAX_UID] = '\0';
         
-        return (int) parsers::parse_uid(string(uid));
+        return (int) parsers::parse_uid(uid);
     }
 
     /**
@@ -783,7 +1358,7 @@ namespace protocols{
      * @param command 
      * @return 0 (false), 1 (true) or FAIL (-1)
      */
-    int gid_receiveTCP(SOCKET * s, char * gid, string command){
+    int gid_receiveTCP(SOCKET * s, char * gid, string_view command){
         memset(gid, '\0', MAX_GID + 1);
         if (word_receiveTCP(s, gid, MAX_GID + 1) == FAIL){
             disconnect(s);
@@ -791,7 +1366,7 @@ namespace protocols{
         }
         gid[MAX_GID] = '\0';
     
-        return (int) parsers::parse_gid(string(gid));
+        return (int) parsers::parse_gid(gid);
     }
 
     /**
@@ -807,7 +1382,7 @@ namespace protocols{
      * @param command 
      * @return 0 (false), 1 (true) or FAIL (-1)
      */
-    int gname_receiveTCP(SOCKET * s, char * gname, string command){
+    int gname_receiveTCP(SOCKET * s, char * gname, string_view command){
         memset(gname, '\0', MAX_GNAME + 1);
         int j = word_receiveTCP(s, gname, MAX_GNAME + 1);
         if (j == FAIL){
@@ -816,7 +1391,7 @@ namespace protocols{
         }
         gname[j] = '\0';
         
-        return (int) parsers::parse_gname(string(gname));
+        return (int) parsers::parse_gname(gname);
     }
 
     /**
@@ -832,7 +1407,7 @@ namespace protocols{
      * @param command 
      * @return 0 (false), 1 (true) or FAIL (-1)
      */
-    int mid_receiveTCP(SOCKET * s, char * mid, string command){
+    int mid_receiveTCP(SOCKET * s, char * mid, string_view command){
         memset(mid, '\0', MAX_MID + 1);
         if (word_receiveTCP(s, mid, MAX_MID + 1) == FAIL){
             disconnect(s);
@@ -840,7 +1415,7 @@ namespace protocols{
         }
         mid[MAX_MID] = '\0';
         
-        return (int) parsers::parse_mid(string(mid));
+        return (int) parsers::parse_mid(mid);
     }
 
     /**
@@ -856,7 +1431,7 @@ namespace protocols{
      * @param command 
      * @return 0 (false), 1 (true) or FAIL (-1)
      */
-    int fname_receiveTCP(SOCKET * s, char * fname, string command){
+    int fname_receiveTCP(SOCKET * s, char * fname, string_view command){
         memset (fname, '\0', MAX_FNAME + 1);
         int a = word_receiveTCP(s, fname, MAX_FNAME + 1);
         if (a == FAIL){
@@ -865,7 +1440,7 @@ namespace protocols{
         }
         fname[a] = '\0';
         
-        return (int) parsers::parse_fname(string(fname));
+        return (int) parsers::parse_fname(fname);
     }
 
     /**
@@ -882,7 +1457,7 @@ namespace protocols{
      * @return true if it received a valid Fsize
      * @return false if it didn't
      */
-    int fsize_receiveTCP(SOCKET * s, char * fsize, string command){
+    int fsize_receiveTCP(SOCKET * s, char * fsize, string_view command){
         memset (fsize, '\0', MAX_FSIZE + 1);
         int b = word_receiveTCP(s, fsize, MAX_FSIZE + 1);
         if (b == FAIL){
@@ -891,7 +1466,7 @@ namespace protocols{
         }
         fsize[b] = '\0';
         
-        return (int) parsers::parse_fsize(string(fsize));
+        return (int) parsers::parse_fsize(fsize);
     }
 
     /**
@@ -905,9 +1480,9 @@ namespace protocols{
      * @param last_caracter
      * @return 0 (false), 1 (true) or FAIL (-1)
      */
-    int text_receiveTCP(SOCKET * s, char * text, int tsize, string command, char * last_caracter){
+    int text_receiveTCP(SOCKET * s, char * text, int tsize, string_view command, char * last_caracter){
         memset(text, '\0', MAX_TEXT + 1);
-        if (receiveTCP(s, text, tsize + 1) == FAIL){
+        if (receiveTCP(s, text, tsize + 1) < tsize + 1){
             disconnect(s);
             return FAIL;
         }
@@ -934,7 +1509,7 @@ namespace protocols{
      * @param command 
      * @return 0 (false), 1 (true) or FAIL (-1)
      */
-    int tsize_receiveTCP(SOCKET * s, char * tsize, string command){
+    int tsize_receiveTCP(SOCKET * s, char * tsize, string_view command){
         memset(tsize, '\0', MAX_TSIZE + 1);
         if (word_receiveTCP(s, tsize, MAX_TSIZE + 1) == FAIL){
             disconnect(s);
@@ -942,33 +1517,195 @@ namespace protocols{
         }
         tsize[MAX_TSIZE] = '\0';
         
-        return (int) parsers::parse_tsize(string(tsize));
+        return (int) parsers::parse_tsize(tsize);
+    }
+
+    //::::::::::::::::::: BINARY FRAMING (V2) ::::::::::::::::::://
+    /**
+     * Builds the fixed header of a framed (v2) request.
+     * Format: magic opcode flags reserved length, where length is
+     * the size of the payload which follows, in network order.
+     * 
+     * @param opcode the request (FRAME_ULIST, FRAME_POST, ...)
+     * @param flags the request flags (e.g. FRAME_KEEP)
+     * @param length the size of the payload
+     * @return string the FRAME_HEADER bytes of the header
+     */
+    string pack_frame(int opcode, int flags, uint32_t length){
+        string header;
+        header += (char) FRAME_MAGIC;
+        header += (char) opcode;
+        header += (char) flags;
+        header += (char) 0;
+        auxiliaries::put_uint(header, length, 4);
+        return header;
+    }
+
+    /**
+     * Reads the fixed header of a framed (v2) request.
+     * 
+     * @param header the FRAME_HEADER bytes of the header
+     * @param opcode gets the request
+     * @param flags gets the request flags
+     * @param length gets the size of the payload
+     * @return int SUCCESS, or FAIL if it isn't a valid header
+     */
+    int unpack_frame(const unsigned char * header, int * opcode, int * flags, uint32_t * length){
+        if ((header[0] != FRAME_MAGIC) || (header[3] != 0)){
+            return FAIL;
+        }
+        *opcode = header[1];
+        *flags = header[2];
+        *length = auxiliaries::get_uint(header + 4, 4);
+        return SUCCESS;
     }
 }
 
 namespace auxiliaries{
+    /**
+     * Finds the first ' ' or '\n' in a block of bytes. Blocks of 32
+     * (AVX2) or 16 (SSE2) bytes are compared at once, when availa-
+     * ble; the rest is scanned byte by byte.
+     * 
+     * @param data the bytes
+     * @param n the number of bytes
+     * @return int the position of the delimiter, or n if there's 
+     * none
+     */
+    int find_delim(const char * data, int n){
+        int i = 0;
+#ifdef __AVX2__
+        const __m256i space32 = _mm256_set1_epi8(' ');
+        const __m256i newline32 = _mm256_set1_epi8('\n');
+        for (; i + 32 <= n; i += 32){
+            __m256i block = _mm256_loadu_si256((const __m256i *) (data + i));
+            unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(
+                _mm256_cmpeq_epi8(block, space32), _mm256_cmpeq_epi8(block, newline32)));
+            if (mask != 0){
+                return i + __builtin_ctz(mask);
+            }
+        }
+#endif
+#ifdef __SSE2__
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i newline = _mm_set1_epi8('\n');
+        for (; i + 16 <= n; i += 16){
+            __m128i block = _mm_loadu_si128((const __m128i *) (data + i));
+            int mask = _mm_movemask_epi8(_mm_or_si128(
+                _mm_cmpeq_epi8(block, space), _mm_cmpeq_epi8(block, newline)));
+            if (mask != 0){
+                return i + __builtin_ctz(mask);
+            }
+        }
+#endif
+        for (; i < n; i++){
+            if ((data[i] == ' ') || (data[i] == '\n')){
+                return i;
+            }
+        }
+        return n;
+    }
+
     /**
      * Given a certain string, divides it in words. Each word is
-     * separated from the rest by ' '.
+     * separated from the rest by ' ', and a '\n' ending the last 
+     * one is dropped. The words point into the string, so nothing
+     * is copied nor allocated.
      * 
      * @param input the string whose words we'll obtain
-     * @return vector<string> the vector of the string's words
+     * @param tokens gets the words of the string
+     * @return int the number of words, or FAIL if there are more
+     * than MAX_TOKENS
      */
-    vector<string> process_string(const string input){
-        vector<string> vec_input;
-        string temp;
-        stringstream stream(input);
-    
-        while(getline(stream, temp, ' ') && !stream.eof())
-            vec_input.push_back(move(temp));
-    
-        if(!temp.empty())
-            vec_input.push_back(move(temp));
+    int split_string(string_view input, TOKENS * tokens){
+        tokens->n = 0;
+        if (!input.empty() && (input.back() == '\n')){
+            input.remove_suffix(1);
+        }
 
-        if(vec_input.back().back()=='\n'){
-            vec_input.back().pop_back();
+        size_t start = 0;
+        while (true){
+            size_t end = input.find(' ', start);
+            if (tokens->n == MAX_TOKENS){
+                return FAIL;
+            }
+            tokens->token[tokens->n++] = input.substr(start, end - start);
+            if (end == string_view::npos){
+                break;
+            }
+            start = end + 1;
+        }
+        return tokens->n;
+    }
+
+    /**
+     * Gets the value of a number made of decimal digits only (it
+     * must have been validated before).
+     * 
+     * @param input the number
+     * @return long the value of the number
+     */
+    long to_number(string_view input){
+        long value = 0;
+        for (size_t i = 0; i < input.size(); i++){
+            value = 10 * value + (input[i] - '0');
         }
-        return vec_input;
+        return value;
+    }
+
+    /**
+     * Appends an unsigned integer to a buffer, in network order
+     * (most significant byte first).
+     * 
+     * @param buffer the buffer
+     * @param value the integer
+     * @param width the number of bytes it takes (2 or 4)
+     */
+    void put_uint(string & buffer, uint32_t value, int width){
+        for (int i = width - 1; i >= 0; i--){
+            buffer += (char) ((value >> (8 * i)) & 0xFF);
+        }
+    }
+
+    /**
+     * Reads an unsigned integer stored in network order.
+     * 
+     * @param data the bytes where it's stored
+     * @param width the number of bytes it takes (2 or 4)
+     * @return uint32_t the integer
+     */
+    uint32_t get_uint(const unsigned char * data, int width){
+        uint32_t value = 0;
+        for (int i = 0; i < width; i++){
+            value = (value << 8) | data[i];
+        }
+        return value;
+    }
+
+    /**
+     * Appends a fixed-width field to a buffer. Fields shorter than
+     * the width (e.g. Fname) are padded with '\0'.
+     * 
+     * @param buffer the buffer
+     * @param field the field
+     * @param width the number of bytes it takes
+     */
+    void put_field(string & buffer, string field, int width){
+        field.resize(width, '\0');
+        buffer += field;
+    }
+
+    /**
+     * Reads a fixed-width field, which ends either at its width 
+     * or at the first '\0'.
+     * 
+     * @param field gets the field (at least width + 1 bytes)
+     * @param data the bytes where it's stored
+     * @param width the number of bytes it takes
+     */
+    void get_field(char * field, const unsigned char * data, int width){
+        memcpy(field, data, width);
+        field[width] = '\0';
     }
 
     /**
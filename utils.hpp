@@ -14,49 +14,99 @@
 #include <string.h>
 #include <cstring>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <cstdio>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <netinet/ip.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include "constant.hpp"
 
 using namespace std;
 
+/* The kinds of fields of a request, each with its own validation */
+enum FIELD_KIND { FIELD_UID, FIELD_PASS, FIELD_GID, FIELD_GNAME, FIELD_COUNT, FIELD_VERSION };
+
+/* The words of a message, pointing into it */
+typedef struct tokens {
+    int n; /* The number of words */
+    string_view token[MAX_TOKENS];
+} TOKENS;
+
+/* A field of a request */
+typedef struct field {
+    FIELD_KIND kind;
+    const char * invalid; /* The status answered when it isn't valid */
+} FIELD;
+
+/* The format of a UDP request: REQ[ field]*, and its answer */
+typedef struct schema {
+    const char * request; /* The request code, e.g. REG */
+    const char * answer; /* The answer code, e.g. RRG */
+    int nfields;
+    FIELD fields[MAX_FIELDS];
+} SCHEMA;
+
 namespace parsers{
     bool parse_nparam(int nparams, int expected);
     
-    bool parse_uid(const string input);
-    bool parse_pass(const string input);
+    bool parse_uid(string_view input);
+    bool parse_pass(string_view input);
 
-    bool parse_gid(const string input);
-    bool parse_gname(const string input);
+    bool parse_gid(string_view input);
+    bool parse_gname(string_view input);
+    bool parse_count(string_view input);
+    bool parse_version(string_view input);
 
-    bool parse_mid(const string input);
+    bool parse_mid(string_view input);
 
-    bool parse_fname(const string input);
-    bool parse_fsize(const string input);
+    bool parse_fname(string_view input);
+    bool parse_fsize(string_view input);
 
-    bool parse_text(const string input);
-    bool parse_tsize(const string input);
+    bool parse_text(string_view input);
+    bool parse_tsize(string_view input);
 
     bool is_number(char input);
     bool is_letter(char input);
+    bool all_of_class(string_view input, unsigned char classes);
+
+    bool parse_field(FIELD_KIND kind, const char * input);
+    const SCHEMA * find_schema(const char * request);
+    int parse_request(const char * request, const SCHEMA ** schema, char fields[][MAX_FIELD + 1]);
+    int serialize_request(const SCHEMA * schema, const char * const * fields, char * request);
 }
 
 namespace checkers{
-    bool check_nparam(int nparams, int expected, string command);
+    bool check_nparam(int nparams, int expected, string_view command);
 
-    bool check_uid(string uid, string command);
-    bool check_pass(string pass, string command);
+    bool check_uid(string_view uid, string_view command);
+    bool check_pass(string_view pass, string_view command);
 
-    bool check_gid(string gid, string command);
-    bool check_gname(string gname, string command);
+    bool check_gid(string_view gid, string_view command);
+    bool check_gname(string_view gname, string_view command);
 
-    bool check_mid(string mid, string command);
+    bool check_mid(string_view mid, string_view command);
+    bool check_count(string_view count, int limit, string_view command);
 
-    bool check_fname(string fname, string command);
-    bool check_fsize(string fsize, string command);
+    bool check_fname(string_view fname, string_view command);
+    bool check_fsize(string_view fsize, string_view command);
 
-    bool check_text(string text, string command);
-    bool check_tsize(string tsize, string command);
+    bool check_text(string_view text, string_view command);
+    bool check_tsize(string_view tsize, string_view command);
 }
 
 typedef struct SOCK{
@@ -64,18 +114,29 @@ typedef struct SOCK{
     int fd;
     struct addrinfo * res;
     struct sockaddr_in addr;
+    char rbuf[RECV_BUFFER]; /* Bytes received (TCP) but not consumed yet */
+    int rpos, rlen; /* The bytes not consumed yet are rbuf[rpos..rlen) */
+    time_t deadline; /* Reads fail past this moment (0 if there's none) */
 } SOCKET;
 
 namespace protocols{
     void disconnect(SOCKET * s);
+    int set_deadlines(SOCKET * s, int seconds);
+    bool before_deadline(SOCKET * s);
+    bool too_slow(time_t start, long nbytes);
+    void set_bandwidth(long bytes_per_sec);
+    void pace(struct timeval start, long nbytes);
+    int set_lane(SOCKET * s, int lane);
 
     //:::::::::::::::::::: GENERIC SENDERS :::::::::::::::::::://
-    int sendUDP(SOCKET * s, string message);
+    int sendUDP(SOCKET * s, const string & message);
     int sendTCP(SOCKET * s, string, int nbytes);
+    int sendbytesTCP(SOCKET * s, const char * data, int nbytes);
 
     //::::::::::::::::::: GENERIC RECEIVERS ::::::::::::::::::://
-    int receiveUDP(SOCKET * s, char * message);
+    int receiveUDP(SOCKET * s, char * message, int size);
     int receiveTCP(SOCKET * s, char * message, int nbytes);
+    int fill_buffer(SOCKET * s);
 
     //:::::::::::::::::::: UDP AUXILIARIES :::::::::::::::::::://
     int sendstatusUDP(SOCKET * s, string command, string status);
@@ -83,26 +144,83 @@ namespace protocols{
 
     //:::::::::::::::::::: TCP AUXILIARIES :::::::::::::::::::://
     int sendfileTCP(SOCKET * s, FILE * file);
-    int receivefileTCP(SOCKET * s, char * fname, int fsize);
+    int streamfileTCP(SOCKET * s, FILE * file);
+    int receivefileTCP(SOCKET * s, char * fname, long fsize);
+    int sendrangeTCP(SOCKET * s, int fd, off_t offset, long length);
+    int receiverangeTCP(SOCKET * s, const char * path, off_t offset, long length);
 
-    int word_receiveTCP(SOCKET * s, char* answer, int limit);
+    int word_receiveTCP(SOCKET * s, char* answer, int limit, char * delimiter = NULL);
 
-    int uid_receiveTCP(SOCKET * s, char * uid, string command);
+    int uid_receiveTCP(SOCKET * s, char * uid, string_view command);
 
-    int gid_receiveTCP(SOCKET * s, char * gid, string command);
-    int gname_receiveTCP(SOCKET * s, char * gname, string command);
+    int gid_receiveTCP(SOCKET * s, char * gid, string_view command);
+    int gname_receiveTCP(SOCKET * s, char * gname, string_view command);
 
-    int mid_receiveTCP(SOCKET * s, char * mid, string command);
+    int mid_receiveTCP(SOCKET * s, char * mid, string_view command);
 
-    int fname_receiveTCP(SOCKET * s, char * fname, string command);
-    int fsize_receiveTCP(SOCKET * s, char * fsize, string command);
+    int fname_receiveTCP(SOCKET * s, char * fname, string_view command);
+    int fsize_receiveTCP(SOCKET * s, char * fsize, string_view command);
     
-    int text_receiveTCP(SOCKET * s, char * text, int tsize, string command, char * last_caracter);
-    int tsize_receiveTCP(SOCKET * s, char * tsize, string command);  
+    int text_receiveTCP(SOCKET * s, char * text, int tsize, string_view command, char * last_caracter);
+    int tsize_receiveTCP(SOCKET * s, char * tsize, string_view command);  
+
+    //::::::::::::::::::: BINARY FRAMING (V2) ::::::::::::::::::://
+    string pack_frame(int opcode, int flags, uint32_t length);
+    int unpack_frame(const unsigned char * header, int * opcode, int * flags, uint32_t * length);
 }
 
 namespace auxiliaries{
-    vector<string> process_string(const string input);
+    /**
+     * Packs a 3-letter request code (e.g. REG) into an integer, so
+     * requests can be dispatched with a switch. Distinct codes give
+     * distinct integers.
+     * 
+     * @param code the request code (or the request itself)
+     * @return constexpr uint32_t the packed code
+     */
+    constexpr uint32_t pack_opcode(const char * code){
+        return ((uint32_t)(unsigned char) code[0] << 16) | ((uint32_t)(unsigned char) code[1] << 8) 
+            | (uint32_t)(unsigned char) code[2];
+    }
+
+    /**
+     * Packs a user command (e.g. unsubscribe) into an integer, so 
+     * commands can be dispatched with a switch. Each character 
+     * ('a' to 'z' or '_') takes 5 bits, so commands of up to 12 
+     * characters give distinct integers; anything else gives 0, 
+     * which matches no command.
+     * 
+     * @param command the command
+     * @return constexpr uint64_t the packed command
+     */
+    constexpr uint64_t pack_command(const char * command){
+        uint64_t packed = 0;
+        for (int i = 0; command[i] != '\0'; i++){
+            uint64_t c = 0;
+            if ((command[i] >= 'a') && (command[i] <= 'z')){
+                c = command[i] - 'a' + 1;
+            }
+            else if (command[i] == '_'){
+                c = 27;
+            }
+            else{
+                return 0;
+            }
+            if (i == 12){
+                return 0;
+            }
+            packed = (packed << 5) | c;
+        }
+        return packed;
+    }
+
+    int find_delim(const char * data, int n);
+    int split_string(string_view input, TOKENS * tokens);
+    long to_number(string_view input);
+    void put_uint(string & buffer, uint32_t value, int width);
+    uint32_t get_uint(const unsigned char * data, int width);
+    void put_field(string & buffer, string field, int width);
+    void get_field(char * field, const unsigned char * data, int width);
     void handle_error(string program, int type);
 }
 